@@ -0,0 +1,246 @@
+#include <alsa/asoundlib.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "alsa_pcm.h"
+#include "diag.h"
+#include "realtime.h"
+#include "rt_check.h"
+#include "util.h"
+
+#define ALSA_PCM_WAIT_MS (100) // the stop flag is checked this often when the device does not wake us up
+
+static snd_pcm_t *pcm = NULL;
+static snd_pcm_format_t format;
+static struct alsa_pcm_config config;
+static float *buf; // one period, for devices that need another format than float
+static pthread_t pcm_tid;
+static volatile bool pcm_running = false;
+static long long xruns = 0;
+
+// In the order they are tried, floats are rendered in place.
+static const snd_pcm_format_t formats[] = {SND_PCM_FORMAT_FLOAT, SND_PCM_FORMAT_S32, SND_PCM_FORMAT_S16};
+
+static int set_hw_params()
+{
+    snd_pcm_hw_params_t *hw;
+    snd_pcm_uframes_t period = config.period_frames;
+    snd_pcm_uframes_t buffer = config.buffer_frames ? config.buffer_frames : 2 * config.period_frames;
+    unsigned rate = config.sample_rate;
+    unsigned channels = config.channels;
+    int err;
+    int i;
+
+    snd_pcm_hw_params_alloca(&hw);
+    if ((err = snd_pcm_hw_params_any(pcm, hw)) < 0)
+        return err;
+    if ((err = snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0)
+        return err;
+    for (i = 0; i < (int)(sizeof(formats) / sizeof(formats[0])); i++)
+    {
+        if (!snd_pcm_hw_params_test_format(pcm, hw, formats[i]))
+            break;
+    }
+    if (i == sizeof(formats) / sizeof(formats[0]))
+        return -EINVAL;
+    format = formats[i];
+    if ((err = snd_pcm_hw_params_set_format(pcm, hw, format)) < 0)
+        return err;
+    if ((err = snd_pcm_hw_params_set_channels_near(pcm, hw, &channels)) < 0)
+        return err;
+    if ((err = snd_pcm_hw_params_set_rate_near(pcm, hw, &rate, NULL)) < 0)
+        return err;
+    if ((err = snd_pcm_hw_params_set_period_size_near(pcm, hw, &period, NULL)) < 0)
+        return err;
+    if ((err = snd_pcm_hw_params_set_buffer_size_near(pcm, hw, &buffer)) < 0)
+        return err;
+    if ((err = snd_pcm_hw_params(pcm, hw)) < 0)
+        return err;
+
+    snd_pcm_hw_params_get_period_size(hw, &period, NULL);
+    snd_pcm_hw_params_get_buffer_size(hw, &buffer);
+    config.sample_rate = rate;
+    config.channels = channels;
+    config.period_frames = period;
+    config.buffer_frames = buffer;
+    return 0;
+}
+
+// The device starts once the whole buffer is filled and wakes the thread up whenever a period is free.
+static int set_sw_params()
+{
+    snd_pcm_sw_params_t *sw;
+    int err;
+
+    snd_pcm_sw_params_alloca(&sw);
+    if ((err = snd_pcm_sw_params_current(pcm, sw)) < 0)
+        return err;
+    if ((err = snd_pcm_sw_params_set_start_threshold(pcm, sw, config.buffer_frames)) < 0)
+        return err;
+    if ((err = snd_pcm_sw_params_set_avail_min(pcm, sw, config.period_frames)) < 0)
+        return err;
+    return snd_pcm_sw_params(pcm, sw);
+}
+
+int alsa_pcm_open(struct alsa_pcm_config *c)
+{
+    int err;
+
+    config = *c;
+    if ((err = snd_pcm_open(&pcm, config.device, SND_PCM_STREAM_PLAYBACK, 0)) < 0)
+    {
+        fprintf(stderr, "%s: Can not open \"%s\", %s\n", __func__, config.device, snd_strerror(err));
+        pcm = NULL;
+        return -1;
+    }
+    if ((err = set_hw_params()) < 0 || (err = set_sw_params()) < 0)
+    {
+        fprintf(stderr, "%s: Can not set up \"%s\" for mmap playback, %s\n", __func__, config.device,
+                snd_strerror(err));
+        alsa_pcm_stop();
+        return -1;
+    }
+    if (format != SND_PCM_FORMAT_FLOAT && !(buf = malloc(config.period_frames * config.channels * sizeof(float))))
+    {
+        fprintf(stderr, "%s: Failed to allocate %d frames\n", __func__, config.period_frames);
+        alsa_pcm_stop();
+        return -1;
+    }
+
+    printf("ALSA %s, %s, channels %d, freq %d, period %d, buffer %d frames\n", config.device,
+           snd_pcm_format_name(format), config.channels, config.sample_rate, config.period_frames,
+           config.buffer_frames);
+    *c = config;
+    return 0;
+}
+
+// Interleaved floats are rendered where the device reads them. Anything else is rendered into buf and converted
+// sample by sample, the areas tell where each channel goes.
+static void render(const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset, int frames, int queued)
+{
+    if (format == SND_PCM_FORMAT_FLOAT)
+    {
+        config.render_cb((float *)((char *)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8), frames,
+                         queued, config.arg);
+        return;
+    }
+
+    config.render_cb(buf, frames, queued, config.arg);
+    for (int c = 0; c < config.channels; c++)
+    {
+        char *dst = (char *)areas[c].addr + (areas[c].first + offset * areas[c].step) / 8;
+        const float *src = buf + c;
+
+        for (int f = 0; f < frames; f++, src += config.channels, dst += areas[c].step / 8)
+        {
+            float sample = max(min(*src, 1.0f), -1.0f);
+            if (format == SND_PCM_FORMAT_S32)
+                *(int32_t *)dst = sample * 2147483647.0;
+            else
+                *(int16_t *)dst = sample * 32767.0;
+        }
+    }
+}
+
+// Renders up to a period into the device buffer. queued frames are waiting to be played in front of it.
+static int write_period(int queued)
+{
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset;
+    snd_pcm_uframes_t frames = config.period_frames;
+    snd_pcm_sframes_t committed;
+    int err;
+
+    rt_check_enter();
+    err = snd_pcm_mmap_begin(pcm, &areas, &offset, &frames);
+    if (!err)
+    {
+        render(areas, offset, frames, queued);
+        committed = snd_pcm_mmap_commit(pcm, offset, frames);
+        if (committed < 0)
+            err = committed;
+        else if (committed != (snd_pcm_sframes_t)frames)
+            err = -EPIPE;
+    }
+    rt_check_leave();
+    return err;
+}
+
+// An underrun or a suspend puts the device back in the prepared state, it starts again once the buffer is refilled.
+static int recover(int err)
+{
+    if (snd_pcm_recover(pcm, err, 1) < 0)
+    {
+        diag_post(DIAG_AUDIO_DEVICE_FAILED, err, xruns);
+        return -1;
+    }
+    diag_post(DIAG_AUDIO_XRUN, ++xruns, err);
+    return 0;
+}
+
+static void *playback_thread(void *arg)
+{
+    realtime_thread_enter();
+    while (pcm_running)
+    {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+        int err;
+
+        if (avail < 0)
+        {
+            err = avail;
+        }
+        else if (avail < config.period_frames)
+        {
+            // A buffer that is not a whole number of periods is never filled up to the start threshold.
+            if (snd_pcm_state(pcm) == SND_PCM_STATE_PREPARED)
+                err = snd_pcm_start(pcm);
+            else
+                err = snd_pcm_wait(pcm, ALSA_PCM_WAIT_MS);
+        }
+        else
+        {
+            err = write_period(max(config.buffer_frames - (int)avail, 0));
+        }
+
+        if (err < 0 && recover(err))
+        {
+            if (config.shutdown_cb)
+                config.shutdown_cb(config.arg);
+            break;
+        }
+    }
+    return NULL;
+}
+
+int alsa_pcm_start(const pthread_attr_t *attr)
+{
+    pcm_running = true;
+    if (pthread_create(&pcm_tid, attr, playback_thread, NULL))
+    {
+        perror("Failed to create ALSA playback thread!");
+        pcm_running = false;
+        return -1;
+    }
+    return 0;
+}
+
+void alsa_pcm_stop()
+{
+    if (pcm_running)
+    {
+        pcm_running = false;
+        pthread_join(pcm_tid, NULL);
+    }
+    if (pcm)
+    {
+        snd_pcm_drop(pcm);
+        snd_pcm_close(pcm);
+        pcm = NULL;
+    }
+    free(buf);
+    buf = NULL;
+}
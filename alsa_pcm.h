@@ -0,0 +1,27 @@
+#pragma once
+
+#include <pthread.h>
+
+// Audio straight to an ALSA PCM device, without SDL in between. The device's ring buffer is memory mapped and each
+// period is rendered in place into it, or converted into it when the device does not take floats.
+
+// Renders frames interleaved frames into buf. queued frames are still to be played before the first of them.
+typedef void (*alsa_pcm_render_cb)(float *buf, int frames, int queued, void *arg);
+
+struct alsa_pcm_config
+{
+    const char *device; // like "hw:0,0", "plughw:1" or "null"
+    int sample_rate;
+    int channels;
+    int period_frames;
+    int buffer_frames; // 0 for two periods
+    alsa_pcm_render_cb render_cb;
+    void (*shutdown_cb)(void *arg); // the device failed and could not be recovered
+    void *arg;
+};
+
+// Opens the device and updates config with the rate, channels and sizes it settled on.
+int alsa_pcm_open(struct alsa_pcm_config *config);
+// Starts the thread that keeps the device buffer filled, with attr like the other audio threads.
+int alsa_pcm_start(const pthread_attr_t *attr);
+void alsa_pcm_stop();
@@ -0,0 +1,182 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bank.h"
+
+static const unsigned char *data = NULL;
+static size_t size = 0;
+static const struct bank_header *header;
+static const uint32_t *by_name;
+static const unsigned char *presets;
+static size_t preset_size;
+
+// Resolved once on load, NULL for parameters this build does not have.
+static struct ctrl_param *params[256];
+static int nbr_params = 0;
+static int nbr_presets = 0;
+
+static atomic_int pending = -1;
+static atomic_int bank = 0; // from MIDI Bank Select, 14 bits
+
+static const struct bank_preset *preset_at(int program)
+{
+    return (const struct bank_preset *)(presets + program * preset_size);
+}
+
+// Maps the bank and checks that it is complete. Every module must have registered its parameters.
+int bank_load(const char *filename)
+{
+    struct stat st;
+    const param_id *ids;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st))
+    {
+        fprintf(stderr, "%s: failed to open \"%s\"\n", __func__, filename);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    bank_free();
+    // Populated up front so that a switch never waits for a page fault.
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        data = NULL;
+        perror("Failed to map preset bank!");
+        return -1;
+    }
+    size = st.st_size;
+
+    header = (const struct bank_header *)data;
+    if (size < sizeof(*header) || memcmp(header->magic, BANK_MAGIC, sizeof(header->magic)) ||
+        header->version != BANK_VERSION || header->nbr_params > sizeof(params) / sizeof(*params))
+    {
+        fprintf(stderr, "%s: \"%s\" is not a preset bank\n", __func__, filename);
+        bank_free();
+        return -1;
+    }
+    preset_size = sizeof(struct bank_preset) + header->nbr_params * sizeof(float);
+    if (size < sizeof(*header) + header->nbr_params * sizeof(param_id) + header->nbr_presets * sizeof(uint32_t) +
+                   header->nbr_presets * preset_size)
+    {
+        fprintf(stderr, "%s: \"%s\" is truncated\n", __func__, filename);
+        bank_free();
+        return -1;
+    }
+
+    ids = (const param_id *)(header + 1);
+    by_name = (const uint32_t *)(ids + header->nbr_params);
+    presets = (const unsigned char *)(by_name + header->nbr_presets);
+    for (unsigned i = 0; i < header->nbr_presets; i++)
+    {
+        if (by_name[i] >= header->nbr_presets || !memchr(preset_at(i)->name, '\0', BANK_NAME_LEN))
+        {
+            fprintf(stderr, "%s: \"%s\" is corrupt\n", __func__, filename);
+            bank_free();
+            return -1;
+        }
+    }
+    for (unsigned i = 0; i < header->nbr_params; i++)
+    {
+        if (!(params[i] = param_get(ids[i])))
+            fprintf(stderr, "%s: unknown parameter %08x is ignored\n", __func__, ids[i]);
+    }
+    nbr_params = header->nbr_params;
+    nbr_presets = header->nbr_presets;
+    printf("%s: %d presets\n", filename, nbr_presets);
+    return 0;
+}
+
+// Only once the audio thread no longer applies presets.
+void bank_free()
+{
+    if (data)
+        munmap((void *)data, size);
+    data = NULL;
+    nbr_params = 0;
+    nbr_presets = 0;
+}
+
+int bank_count()
+{
+    return nbr_presets;
+}
+
+const char *bank_name(int program)
+{
+    return program >= 0 && program < nbr_presets ? preset_at(program)->name : NULL;
+}
+
+// Returns the program number of the preset, or -1.
+int bank_find(const char *name)
+{
+    int lo = 0;
+    int hi = nbr_presets - 1;
+
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        int c = strncmp(name, preset_at(by_name[mid])->name, BANK_NAME_LEN);
+        if (c == 0)
+            return by_name[mid];
+        if (c < 0)
+            hi = mid - 1;
+        else
+            lo = mid + 1;
+    }
+    return -1;
+}
+
+// From any thread, the preset goes in at the start of the next block.
+void bank_select(int program)
+{
+    if (program >= 0 && program < nbr_presets)
+        atomic_store_explicit(&pending, program, memory_order_release);
+}
+
+// From any thread, returns true if the controller was Bank Select. The bank is used by the next program change.
+bool bank_control(int number, int value)
+{
+    int b = atomic_load_explicit(&bank, memory_order_relaxed);
+
+    if (number == BANK_SELECT_MSB)
+        b = (value & 0x7f) << 7 | (b & 0x7f);
+    else if (number == BANK_SELECT_LSB)
+        b = (b & ~0x7f) | (value & 0x7f);
+    else
+        return false;
+    atomic_store_explicit(&bank, b, memory_order_relaxed);
+    return true;
+}
+
+// From any thread, selects the program in the bank chosen with Bank Select.
+void bank_program_change(int program)
+{
+    bank_select(atomic_load_explicit(&bank, memory_order_relaxed) * 128 + program);
+}
+
+// Called by the renderer at the start of every block, before the parameters are read. Returns true if a preset was
+// applied.
+bool bank_apply()
+{
+    int program = atomic_exchange_explicit(&pending, -1, memory_order_acquire);
+    const float *values;
+
+    if (program < 0)
+        return false;
+    values = (const float *)(preset_at(program) + 1);
+    for (int i = 0; i < nbr_params; i++)
+    {
+        if (!isnan(values[i]))
+            param_set(params[i], values[i]);
+    }
+    return true;
+}
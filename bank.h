@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "param.h"
+
+// A bank of presets, built with mkbank from settings files and mapped at startup. Every preset is a row of values
+// in the order of the parameter ids in the header, so switching is one pass over the row and never touches the file
+// system.
+//
+// header | param_id ids[nbr_params] | uint32_t by_name[nbr_presets] | presets
+//
+// by_name holds the preset numbers sorted by name. A value that is NAN leaves the parameter as it is.
+
+#define BANK_MAGIC "SYN1BANK"
+#define BANK_VERSION (1)
+#define BANK_NAME_LEN (32)
+
+// MIDI Bank Select controllers, the bank they pick is 128 programs.
+#define BANK_SELECT_MSB (0)
+#define BANK_SELECT_LSB (32)
+
+struct bank_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t nbr_params;
+    uint32_t nbr_presets;
+    uint32_t reserved;
+};
+
+// Followed by nbr_params float values.
+struct bank_preset
+{
+    char name[BANK_NAME_LEN];
+};
+
+int bank_load(const char *filename);
+void bank_free();
+int bank_count();
+int bank_find(const char *name);
+const char *bank_name(int program);
+void bank_select(int program);
+bool bank_control(int number, int value);
+void bank_program_change(int program);
+bool bank_apply();
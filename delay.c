@@ -1,15 +1,14 @@
 #include "delay.h"
-#include <SDL3/SDL_audio.h>
+#include "diag.h"
+#include <stdio.h>
+#include <stdlib.h>
 
-static int pos = 0;
-static float *buffer; // ringbuffer with pos as last entered sample
-static int delay_buffer_len = 0;
-
-int delay_init(const SDL_AudioSpec *spec, unsigned max_len_ms)
+int delay_init(struct delay *d, int sample_rate, unsigned max_len_ms)
 {
-    delay_buffer_len = spec->freq * max_len_ms / 1000;
-    buffer = calloc(delay_buffer_len, sizeof(float));
-    if (!buffer)
+    d->pos = 0;
+    d->len = sample_rate * max_len_ms / 1000;
+    d->buffer = calloc(d->len * DELAY_CHANNELS, sizeof(float));
+    if (!d->buffer)
     {
         printf("Failed to allocate ringbuffer for delay!\n");
         return -1;
@@ -17,29 +16,32 @@ int delay_init(const SDL_AudioSpec *spec, unsigned max_len_ms)
     return 0;
 }
 
-float delay_get_sample(float delay_ms, const SDL_AudioSpec *spec)
+float delay_get_sample(struct delay *d, float delay_ms, int channel, int sample_rate)
 {
-    int delay_samples = spec->freq * delay_ms / 1000;
-    if (delay_samples >= delay_buffer_len)
+    int delay_samples = sample_rate * delay_ms / 1000;
+    if (delay_samples >= d->len)
     {
-        printf("Too large delay!");
+        diag_post(DIAG_DELAY_TOO_LONG, delay_samples, d->len);
+        delay_samples = d->len - 1;
     }
 
-    int ret_pos = pos - delay_samples;
+    int ret_pos = d->pos - delay_samples;
     if (ret_pos < 0)
-        ret_pos = delay_buffer_len + ret_pos;
+        ret_pos = d->len + ret_pos;
 
-    return buffer[ret_pos];
+    return d->buffer[ret_pos * DELAY_CHANNELS + channel];
 }
 
-void delay_put_sample(float sample)
+void delay_put_frame(struct delay *d, const float *frame)
 {
-    pos += 1;
-    pos = pos % delay_buffer_len;
-    buffer[pos] = sample;
+    d->pos += 1;
+    d->pos = d->pos % d->len;
+    for (int c = 0; c < DELAY_CHANNELS; c++)
+        d->buffer[d->pos * DELAY_CHANNELS + c] = frame[c];
 }
 
-void delay_shutdown()
+void delay_shutdown(struct delay *d)
 {
-    free(buffer);
+    free(d->buffer);
+    d->buffer = NULL;
 }
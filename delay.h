@@ -1,8 +1,15 @@
 #pragma once
 
-#include <SDL3/SDL_audio.h>
+#define DELAY_CHANNELS (2)
 
-int delay_init(const SDL_AudioSpec *spec, unsigned max_len_ms);
-float delay_get_sample(float delay_ms, const SDL_AudioSpec *spec);
-void delay_put_sample(float sample);
-void delay_shutdown();
+struct delay
+{
+    int pos;
+    float *buffer; // ringbuffer of DELAY_CHANNELS interleaved frames with pos as last entered frame
+    int len;
+};
+
+int delay_init(struct delay *d, int sample_rate, unsigned max_len_ms);
+float delay_get_sample(struct delay *d, float delay_ms, int channel, int sample_rate);
+void delay_put_frame(struct delay *d, const float *frame);
+void delay_shutdown(struct delay *d);
@@ -0,0 +1,153 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "diag.h"
+
+#define RING_LEN (256) // power of two
+#define DRAIN_INTERVAL_NS (100000000)
+
+static const char *formats[DIAG_EVENT_COUNT] = {
+    [DIAG_DELAY_TOO_LONG] = "Too large delay! %lld samples, buffer is %lld\n",
+    [DIAG_INVALID_OSC_TYPE] = "Invalid oscillator type %lld\n",
+    [DIAG_BAD_START_FRAME] = "Bad startframe %lld or frame %lld\n",
+    [DIAG_AUDIO_STREAM_ERROR] = "Failed to put %lld frames to the audio stream\n",
+    [DIAG_EVENT_DROPPED] = "Event %lld dropped, the queue of part %lld is full\n",
+    [DIAG_MIDI_DROPPED] = "MIDI event %lld at frame %lld dropped, the queue is full\n",
+    [DIAG_AUDIO_XRUN] = "Audio underrun %lld, recovered from error %lld\n",
+    [DIAG_AUDIO_DEVICE_FAILED] = "Audio device failed with error %lld after %lld underruns\n",
+    [DIAG_JOURNAL_WRITE_FAILED] = "Journal write failed with errno %lld, it ends after record %lld\n",
+};
+
+struct diag_entry
+{
+    atomic_uint seq;
+    enum diag_event event;
+    long long a;
+    long long b;
+};
+
+// Bounded multi-producer, single consumer queue. A slot is free for the producer at position pos when its seq equals
+// pos, and holds an entry for the consumer when seq equals pos + 1.
+static struct diag_entry ring[RING_LEN];
+static atomic_uint head = 0;
+static unsigned tail = 0;
+static atomic_uint dropped = 0;
+
+static pthread_t drain_thread;
+static atomic_bool running = false;
+
+void diag_post(enum diag_event event, long long a, long long b)
+{
+    unsigned pos = atomic_load_explicit(&head, memory_order_relaxed);
+    struct diag_entry *e;
+
+    while (true)
+    {
+        e = &ring[pos % RING_LEN];
+        unsigned seq = atomic_load_explicit(&e->seq, memory_order_acquire);
+        int diff = (int)(seq - pos);
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&head, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // Full, never wait for the consumer.
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&head, memory_order_relaxed);
+        }
+    }
+
+    e->event = event;
+    e->a = a;
+    e->b = b;
+    atomic_store_explicit(&e->seq, pos + 1, memory_order_release);
+}
+
+static void drain()
+{
+    static unsigned reported_dropped = 0;
+
+    while (true)
+    {
+        struct diag_entry *e = &ring[tail % RING_LEN];
+        if (atomic_load_explicit(&e->seq, memory_order_acquire) != tail + 1)
+            break;
+        if (e->event < DIAG_EVENT_COUNT)
+            fprintf(stderr, formats[e->event], e->a, e->b);
+        atomic_store_explicit(&e->seq, tail + RING_LEN, memory_order_release);
+        tail++;
+    }
+
+    unsigned d = atomic_load_explicit(&dropped, memory_order_relaxed);
+    if (d != reported_dropped)
+    {
+        fprintf(stderr, "%u diagnostic messages dropped\n", d - reported_dropped);
+        reported_dropped = d;
+    }
+}
+
+static void *drain_loop(void *arg)
+{
+    struct timespec interval = {.tv_nsec = DRAIN_INTERVAL_NS};
+
+    (void)arg;
+    while (atomic_load(&running))
+    {
+        drain();
+        nanosleep(&interval, NULL);
+    }
+    drain();
+    return NULL;
+}
+
+// The printing is never urgent, the drain thread only runs when nothing else wants the cpu. SCHED_IDLE needs no
+// privileges, but a sandbox may still refuse it and then the thread runs like any other.
+static int create_drain_thread()
+{
+    struct sched_param param = {.sched_priority = 0};
+    pthread_attr_t attr;
+    int ret;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_IDLE);
+    pthread_attr_setschedparam(&attr, &param);
+    ret = pthread_create(&drain_thread, &attr, drain_loop, NULL);
+    pthread_attr_destroy(&attr);
+    if (ret)
+        ret = pthread_create(&drain_thread, NULL, drain_loop, NULL);
+    return ret;
+}
+
+int diag_start()
+{
+    for (unsigned i = 0; i < RING_LEN; i++)
+        atomic_init(&ring[i].seq, i);
+
+    atomic_store(&running, true);
+    if (create_drain_thread())
+    {
+        perror("Failed to create diagnostics thread!");
+        atomic_store(&running, false);
+        return -1;
+    }
+    return 0;
+}
+
+void diag_stop()
+{
+    if (atomic_exchange(&running, false))
+        pthread_join(drain_thread, NULL);
+}
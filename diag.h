@@ -0,0 +1,22 @@
+#pragma once
+
+// Diagnostics that are safe to post from the audio thread. Events go into a fixed size lock-free ring and are
+// formatted and printed by a low priority thread.
+
+enum diag_event
+{
+    DIAG_DELAY_TOO_LONG = 0,
+    DIAG_INVALID_OSC_TYPE,
+    DIAG_BAD_START_FRAME,
+    DIAG_AUDIO_STREAM_ERROR,
+    DIAG_EVENT_DROPPED,
+    DIAG_MIDI_DROPPED,
+    DIAG_AUDIO_XRUN,
+    DIAG_AUDIO_DEVICE_FAILED,
+    DIAG_JOURNAL_WRITE_FAILED,
+    DIAG_EVENT_COUNT,
+};
+
+void diag_post(enum diag_event event, long long a, long long b);
+int diag_start();
+void diag_stop();
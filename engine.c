@@ -0,0 +1,649 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cosine.h"
+#include "distortion.h"
+#include "engine.h"
+
+static const struct engine_params defaults = {
+    .amplitude =
+        {
+            .label = "LINEAR GAIN",
+            .value = 0.7,
+            .min = 0.1,
+            .max = 3,
+        },
+    .octave =
+        {
+            .label = "OCTAVE",
+            .value = 0,
+            .min = 0,
+            .max = 5,
+            .quantized_to_int = true,
+        },
+    .osc_type =
+        {
+            .label = "PULSE/SAW/FM",
+            .value = OSC_TYPE_PULSE,
+            .min = 0,
+            .max = OSC_TYPE_COUNT - 1,
+            .quantized_to_int = true,
+        },
+    .cutoff =
+        {
+            .label = "CUTOFF",
+            .value = 17000,
+            .min = 50,
+            .max = 17000,
+        },
+    .resonance =
+        {
+            .label = "RESONANCE",
+            .value = 0.0,
+            .min = 0.0,
+            .max = 0.98,
+        },
+    .key_to_cutoff =
+        {
+            .label = "KEY TO CUTOFF",
+            .value = 0.0,
+            .min = 0.0,
+            .max = 1.0,
+        },
+    .cutoff_lfo_freq =
+        {
+            .label = "CUTOFF LFO FREQ",
+            .value = 0.0,
+            .min = 0.0,
+            .max = 5.0,
+        },
+    .cutoff_lfo_amp =
+        {
+            .label = "CUTOFF LFO AMP",
+            .value = 0.0,
+            .min = 0.0,
+            .max = 5000.0,
+        },
+    .dist_level =
+        {
+            .label = "DIST THRESHOLD",
+            .value = 1.0,
+            .min = 0.01,
+            .max = 1.0,
+        },
+    .flip_level =
+        {
+            .label = "FLIP THRESHOLD",
+            .value = 1.1,
+            .min = 0.01,
+            .max = 1.1,
+        },
+    .A =
+        {
+            .label = "A",
+            .value = 0.1,
+            .min = 0.1,
+            .max = 500.0,
+        },
+    .D =
+        {
+            .label = "D",
+            .value = 25,
+            .min = 0.1,
+            .max = 500,
+        },
+    .S =
+        {
+            .label = "S",
+            .value = 1,
+            .min = 0,
+            .max = 1,
+        },
+    .R =
+        {
+            .label = "R",
+            .value = 0,
+            .min = 0,
+            .max = 1000,
+        },
+    .env_to_cutoff =
+        {
+            .label = "ENV TO CUTOFF",
+            .value = 0,
+            .min = 0,
+            .max = 10000,
+        },
+    .pan_spread =
+        {
+            .label = "PAN SPREAD",
+            .value = 0.0,
+            .min = 0.0,
+            .max = 1.0,
+        },
+    .env_to_amp =
+        {
+            .label = "ENV TO AMP",
+            .value = 1.0,
+            .min = 0,
+            .max = 1.0,
+            .quantized_to_int = true,
+        },
+    .delay_ms =
+        {
+            .label = "DELAY [MS]",
+            .value = 600,
+            .min = 0,
+            .max = 1000,
+        },
+    .delay_fb =
+        {
+            .label = "DELAY FEEDBACK",
+            .value = 0.0,
+            .min = 0.0,
+            .max = 0.9,
+        },
+    .chorus_amount =
+        {
+            .label = "CHORUS AMOUNT",
+            .value = 0.0,
+            .min = 0.0,
+            .max = 1.0,
+        },
+    .chorus_freq =
+        {
+            .label = "CHORUS FREQ",
+            .value = 1.0,
+            .min = 0.1,
+            .max = 5.0,
+        },
+    .bpm =
+        {
+            .label = "BPM",
+            .value = 120,
+            .min = 40,
+            .max = 240,
+        },
+    .gate =
+        {
+            .label = "STEP GATE",
+            .value = 0.5,
+            .min = 0.05,
+            .max = 1.0,
+        },
+};
+
+static void params_init(struct engine_params *p)
+{
+    *p = defaults;
+    p->tone_ctrls =
+        (struct ctrl_param_group){.params = {&p->amplitude, &p->osc_type, &p->octave, &p->env_to_amp, &p->pan_spread}};
+    p->envelope_ctrls = (struct ctrl_param_group){.params = {&p->A, &p->D, &p->S, &p->R}};
+    p->filter_ctrls = (struct ctrl_param_group){.params = {&p->cutoff, &p->resonance, &p->env_to_cutoff,
+                                                           &p->key_to_cutoff, &p->cutoff_lfo_freq,
+                                                           &p->cutoff_lfo_amp}};
+    p->dist_ctrls = (struct ctrl_param_group){.params = {&p->dist_level, &p->flip_level}};
+    p->delay_ctrls = (struct ctrl_param_group){.params = {&p->delay_fb, &p->delay_ms}};
+    p->chorus_ctrls = (struct ctrl_param_group){.params = {&p->chorus_amount, &p->chorus_freq}};
+    p->sequencer_ctrls = (struct ctrl_param_group){.params = {&p->bpm, &p->gate}};
+
+    struct ctrl_param_group *groups[ENGINE_MAX_GROUPS] = {
+        &p->tone_ctrls,  &p->envelope_ctrls, &p->filter_ctrls,    &p->dist_ctrls,
+        &p->delay_ctrls, &p->chorus_ctrls,   &p->sequencer_ctrls, NULL};
+    memcpy(p->groups, groups, sizeof(groups));
+}
+
+// The sequencer plays every step at full velocity.
+static void step_press(void *arg, int key, long long frame)
+{
+    engine_note_on(arg, key, 1.0, frame);
+}
+
+static void step_release(void *arg, int key, long long frame)
+{
+    engine_note_off(arg, key, frame);
+}
+
+void engine_init(struct engine *e)
+{
+    memset(e, 0, sizeof(*e));
+    params_init(&e->p);
+    osc_params_init(&e->osc);
+    fm_init(&e->fm);
+    sequencer_init(&e->seq, step_press, step_release, e);
+
+    ramp_add(&e->ramps, &e->amplitude_ramp, &e->p.amplitude, 20, RAMP_LINEAR);
+    ramp_add(&e->ramps, &e->cutoff_ramp, &e->p.cutoff, 30, RAMP_EXP);
+    ramp_add(&e->ramps, &e->delay_ms_ramp, &e->p.delay_ms, 200, RAMP_LINEAR); // a slow glide instead of a pitch jump
+    ramp_add(&e->ramps, &e->delay_fb_ramp, &e->p.delay_fb, 20, RAMP_LINEAR);
+
+    e->cutoff_dest = mod_add_dest(&e->mod, &e->p.cutoff);
+    e->amplitude_dest = mod_add_dest(&e->mod, &e->p.amplitude);
+    e->resonance_dest = mod_add_dest(&e->mod, &e->p.resonance);
+    // What used to be the fixed cutoff sum, the sliders set the amounts.
+    mod_add_route(&e->mod, MOD_SRC_KEY, 0, &e->p.cutoff, 0.0, &e->p.key_to_cutoff);
+    mod_add_route(&e->mod, MOD_SRC_ENV, 0, &e->p.cutoff, 0.0, &e->p.env_to_cutoff);
+    mod_add_route(&e->mod, MOD_SRC_LFO, 0, &e->p.cutoff, 0.0, &e->p.cutoff_lfo_amp);
+}
+
+static void freeze_groups(struct ctrl_param_group **groups)
+{
+    struct ctrl_param_group *pg;
+
+    while ((pg = *groups++))
+    {
+        for (int i = 0; i < MAX_PARAMS_PER_GROUP && pg->params[i]; i++)
+            pg->params[i]->block = pg->params[i]->value;
+    }
+}
+
+// Takes every parameter for the block, each read once. Everything the block renders reads block instead of value, so
+// a value set from another thread in the middle of it waits for the next one.
+static void freeze_params(struct engine *e)
+{
+    freeze_groups(e->p.groups);
+    freeze_groups(e->osc.groups);
+    freeze_groups(e->fm.groups);
+}
+
+// Everything that depends on the format the engine renders in.
+int engine_open(struct engine *e, int sample_rate, int channels)
+{
+    freeze_params(e);
+    e->sample_rate = sample_rate;
+    e->channels = channels;
+    if (delay_init(&e->delay, sample_rate, ENGINE_MAX_DELAY_MS))
+        return -1;
+
+    for (int i = 0; i < NBR_VOICES; i++)
+    {
+        struct voice *voice = &e->voices[i];
+
+        voice->pressed = 0;
+        voice->released = 0;
+        osc_init(&voice->osc);
+        envelope_init(&voice->env, sample_rate);
+        low_pass_filter_init(&voice->filter, e->p.resonance.block, e->p.cutoff.block, sample_rate);
+    }
+    return 0;
+}
+
+void engine_close(struct engine *e)
+{
+    delay_shutdown(&e->delay);
+}
+
+static void tap(struct engine *e, enum engine_input input, int key, float value, long long frame)
+{
+    if (e->tap)
+        e->tap(input, key, value, frame);
+}
+
+void engine_note_on(struct engine *e, int key, float velocity, long long frame)
+{
+    struct voice *oldest_voice = &e->voices[0];
+
+    tap(e, ENGINE_NOTE_ON, key, velocity, frame);
+
+    // notes higher that 0x53 are really bad so no need to even try
+    if (key >= 0x53)
+        return;
+    // find oldest empty spot and if key is already in the array
+    for (int i = 0; i < NBR_VOICES; i++)
+    {
+        struct voice *voice = &e->voices[i];
+        // compare current to oldest
+        if (oldest_voice->released > voice->released)
+        {
+            oldest_voice = voice;
+        }
+        else if (oldest_voice->released == voice->released && oldest_voice->pressed > voice->pressed)
+        {
+            oldest_voice = voice;
+        }
+
+        if (voice->key == key)
+        {
+            if (voice->released <= frame)
+            {
+                oldest_voice = voice;
+                break;
+            }
+            return;
+        }
+    }
+
+    envelope_start(&oldest_voice->env, frame);
+    oldest_voice->released = INT64_MAX;
+    oldest_voice->pressed = frame;
+
+    oldest_voice->key = key;
+    oldest_voice->velocity = velocity;
+}
+
+static void voice_off(struct engine *e, struct voice *voice, long long frame)
+{
+    tap(e, ENGINE_NOTE_OFF, voice->key, 0.0, frame);
+    if (e->p.env_to_amp.block > 0.5)
+    {
+        envelope_release(&voice->env, frame);
+    }
+    else
+    {
+        voice->key = 0;
+    }
+    voice->released = frame;
+}
+
+void engine_note_off(struct engine *e, int key, long long frame)
+{
+    for (int i = 0; i < NBR_VOICES; i++)
+    {
+        struct voice *voice = &e->voices[i];
+        if (voice->key == key && voice->released > frame)
+        {
+            voice_off(e, voice, frame);
+            return;
+        }
+    }
+}
+
+void engine_all_notes_off(struct engine *e, long long frame)
+{
+    for (int i = 0; i < NBR_VOICES; i++)
+    {
+        struct voice *voice = &e->voices[i];
+        if (voice->released > frame)
+        {
+            voice_off(e, voice, frame);
+        }
+    }
+}
+
+void engine_control(struct engine *e, int number, int value, long long frame)
+{
+    tap(e, ENGINE_CONTROL, number, value, frame);
+    mod_set_cc(&e->mod, number, value);
+    // All sound off and all notes off, no other controller is mapped yet.
+    if (number == 120 || number == 123)
+        engine_all_notes_off(e, frame);
+}
+
+// The lowest key that is held down, 1 if none is.
+int engine_lowest_key(const struct engine *e)
+{
+    const struct voice *lowest_voice = NULL;
+
+    for (int i = 0; i < NBR_VOICES; i++)
+    {
+        const struct voice *voice = &e->voices[i];
+        if (voice->pressed < voice->released && (!lowest_voice || lowest_voice->key > voice->key))
+            lowest_voice = voice;
+    }
+    return lowest_voice ? lowest_voice->key : 1;
+}
+
+// Parameter values for the block, worked out from what freeze_params() took. The kernels and the effects read only
+// from here.
+struct render_params
+{
+    float amplitude;
+    float amplitude_step; // per frame
+    float A;
+    float D;
+    float S;
+    float R;
+    float cutoff;
+    float resonance;
+    float lfo_freq;
+    float pan_gain[NBR_VOICES][2];
+    struct osc_block osc;
+    struct fm_block fm;
+    float dist_level;
+    float flip_level;
+    float chorus_amount;
+    float chorus_freq;
+};
+
+typedef void (*voice_kernel)(struct engine *e, struct voice *voice, long long start_frame, int frames,
+                             float (*mix)[2], const float *pan_gain, const struct render_params *rp);
+
+static void snapshot_params(const struct engine *e, struct render_params *rp)
+{
+    const struct engine_params *p = &e->p;
+
+    rp->A = p->A.block;
+    rp->D = p->D.block;
+    rp->S = p->S.block;
+    rp->R = p->R.block;
+    rp->resonance = p->resonance.block;
+    rp->lfo_freq = p->cutoff_lfo_freq.block;
+    rp->dist_level = p->dist_level.block;
+    rp->flip_level = p->flip_level.block;
+    rp->chorus_amount = p->chorus_amount.block;
+    rp->chorus_freq = p->chorus_freq.block;
+    osc_snapshot(&e->osc, &rp->osc);
+    fm_snapshot(&e->fm, &rp->fm);
+
+    // Voices are spread evenly over the stereo field. Equal power panning, scaled so that a centered voice keeps
+    // unity gain in both channels.
+    for (int i = 0; i < NBR_VOICES; i++)
+    {
+        float pos = p->pan_spread.block * (2.0 * i / (NBR_VOICES - 1) - 1.0);
+        float angle = (pos + 1.0) * M_PI / 4;
+        rp->pan_gain[i][0] = M_SQRT2 * cos(angle);
+        rp->pan_gain[i][1] = M_SQRT2 * sin(angle);
+    }
+}
+
+// The smoothed parameters, once the length of the block is known.
+static void snapshot_ramps(struct engine *e, struct render_params *rp, int frames)
+{
+    ramp_block(&e->ramps, frames, e->sample_rate);
+    rp->amplitude = e->amplitude_ramp.start;
+    rp->amplitude_step = (e->amplitude_ramp.value - e->amplitude_ramp.start) / frames;
+    rp->cutoff = e->cutoff_ramp.value;
+}
+
+static void configure_filter(const struct engine *e, struct voice *voice, const struct render_params *rp,
+                             const float *mod)
+{
+    low_pass_filter_configure(&voice->filter, mod_apply(&e->mod, e->cutoff_dest, rp->cutoff, mod),
+                              mod_apply(&e->mod, e->resonance_dest, rp->resonance, mod), e->sample_rate);
+}
+
+// Renders one voice for a whole block and adds it to mix. Every configuration argument is a compile time constant
+// in the generated kernels below, so all the mode tests fold away. Without mod_on the modulation is the same for the
+// whole block and is evaluated once, otherwise every MOD_INTERVAL frames.
+static inline __attribute__((always_inline)) void render_voice(struct engine *e, struct voice *voice,
+                                                               long long start_frame, int frames, float (*mix)[2],
+                                                               const float *pan_gain, const struct render_params *rp,
+                                                               const enum osc_type type, const bool env_to_amp_on,
+                                                               const bool mod_on)
+{
+    int sample_rate = e->sample_rate;
+    const struct mod_matrix *m = &e->mod;
+    float freq = key_to_freq[voice->key][0];
+    float sources[MOD_SRC_COUNT] = {[MOD_SRC_VELOCITY] = voice->velocity, [MOD_SRC_KEY] = freq};
+    float mod[MOD_MAX_DESTS] = {};
+    bool amplitude_routed = mod_routed(m, e->amplitude_dest);
+
+    if (!mod_on)
+    {
+        mod_eval(m, sources, mod);
+        configure_filter(e, voice, rp, mod);
+    }
+
+    for (int s = 0; s < frames; s++)
+    {
+        long long current_frame = start_frame + s;
+        float raw_sample;
+        float amp = rp->amplitude + s * rp->amplitude_step;
+
+        if (type == OSC_TYPE_FM)
+            raw_sample = fm_render_sample(&e->fm, &rp->fm, current_frame - voice->pressed, sample_rate, freq);
+        else if (type == OSC_TYPE_PULSE)
+            raw_sample = osc_render_pulse_sample(current_frame, &voice->osc, &rp->osc, sample_rate, voice->key);
+        else
+            raw_sample = osc_render_saw_sample(current_frame, &voice->osc, &rp->osc, sample_rate, voice->key);
+
+        // envelope
+        float env = envelope_get(&voice->env, rp->A, rp->D, rp->S, rp->R, current_frame);
+        if (!env_to_amp_on && 0.0 == env)
+        {
+            voice->key = 0;
+            return;
+        }
+
+        // modulation, at control rate
+        if (mod_on && s % MOD_INTERVAL == 0)
+        {
+            sources[MOD_SRC_ENV] = env;
+            if (mod_uses(m, MOD_SRC_LFO))
+                sources[MOD_SRC_LFO] = cosine_render_sample(current_frame, sample_rate, rp->lfo_freq);
+            mod_eval(m, sources, mod);
+            configure_filter(e, voice, rp, mod);
+        }
+
+        raw_sample *= amplitude_routed ? mod_apply(m, e->amplitude_dest, amp, mod) : amp;
+        if (env_to_amp_on)
+        {
+            raw_sample = raw_sample * env;
+        }
+
+        // filter
+        float out = low_pass_filter_get_output(&voice->filter, raw_sample);
+        mix[s][0] += pan_gain[0] * out;
+        mix[s][1] += pan_gain[1] * out;
+    }
+}
+
+// One kernel per oscillator type, envelope routing and whether the modulation moves within a block.
+#define VOICE_KERNELS(X)                                                                                               \
+    X(pulse, OSC_TYPE_PULSE, 0, 0)                                                                                     \
+    X(pulse, OSC_TYPE_PULSE, 0, 1)                                                                                     \
+    X(pulse, OSC_TYPE_PULSE, 1, 0)                                                                                     \
+    X(pulse, OSC_TYPE_PULSE, 1, 1)                                                                                     \
+    X(saw, OSC_TYPE_SAW, 0, 0)                                                                                         \
+    X(saw, OSC_TYPE_SAW, 0, 1)                                                                                         \
+    X(saw, OSC_TYPE_SAW, 1, 0)                                                                                         \
+    X(saw, OSC_TYPE_SAW, 1, 1)                                                                                         \
+    X(fm, OSC_TYPE_FM, 0, 0)                                                                                           \
+    X(fm, OSC_TYPE_FM, 0, 1)                                                                                           \
+    X(fm, OSC_TYPE_FM, 1, 0)                                                                                           \
+    X(fm, OSC_TYPE_FM, 1, 1)
+
+#define DEFINE_VOICE_KERNEL(name, type, env_to_amp_on, mod_on)                                                         \
+    static void render_voice_##name##_##env_to_amp_on##_##mod_on(struct engine *e, struct voice *voice,               \
+                                                                 long long start_frame, int frames, float(*mix)[2],    \
+                                                                 const float *pan_gain,                                \
+                                                                 const struct render_params *rp)                       \
+    {                                                                                                                  \
+        render_voice(e, voice, start_frame, frames, mix, pan_gain, rp, type, env_to_amp_on, mod_on);                   \
+    }
+VOICE_KERNELS(DEFINE_VOICE_KERNEL)
+#undef DEFINE_VOICE_KERNEL
+
+#define VOICE_KERNEL_ENTRY(name, type, env_to_amp_on, mod_on)                                                          \
+    [type][env_to_amp_on][mod_on] = render_voice_##name##_##env_to_amp_on##_##mod_on,
+static const voice_kernel voice_kernels[OSC_TYPE_COUNT][2][2] = {VOICE_KERNELS(VOICE_KERNEL_ENTRY)};
+#undef VOICE_KERNEL_ENTRY
+
+static voice_kernel select_voice_kernel(const struct engine *e)
+{
+    int type = min(OSC_TYPE_COUNT - 1, max(0, (int)e->p.osc_type.block));
+    bool env_to_amp_on = e->p.env_to_amp.block > 0.5;
+    bool mod_on = mod_uses(&e->mod, MOD_SRC_ENV) || mod_uses(&e->mod, MOD_SRC_LFO);
+
+    return voice_kernels[type][env_to_amp_on][mod_on];
+}
+
+static void render_effects(struct engine *e, float *frame, const long long current_frame, int s, int frames,
+                           const struct render_params *rp)
+{
+    int c;
+    float chorus_lfo = cosine_render_sample(current_frame, e->sample_rate, rp->chorus_freq);
+    float delay_time = ramp_at(&e->delay_ms_ramp, s, frames);
+    float feedback = ramp_at(&e->delay_fb_ramp, s, frames);
+
+    for (c = 0; c < DELAY_CHANNELS; c++)
+    {
+        // distort
+        frame[c] = distort(frame[c], rp->dist_level, rp->flip_level);
+
+        // echo
+        frame[c] += feedback * delay_get_sample(&e->delay, delay_time, c, e->sample_rate);
+    }
+    delay_put_frame(&e->delay, frame);
+
+    for (c = 0; c < DELAY_CHANNELS; c++)
+    {
+        // chorus, the channels sweep in opposite phase to widen the image
+        float chorus_delay_ms = 3.0 + (c == 0 ? 1.0 : -1.0) * chorus_lfo;
+        frame[c] += rp->chorus_amount * delay_get_sample(&e->delay, chorus_delay_ms, c, e->sample_rate);
+
+        frame[c] = distort(frame[c], 0.999, 100.0);
+    }
+}
+
+static void write_frame(const float *frame, float **buf, int channels)
+{
+    float *out = *buf;
+    if (channels == 1)
+    {
+        out[0] = 0.5 * (frame[0] + frame[1]);
+    }
+    else
+    {
+        out[0] = frame[0];
+        out[1] = frame[1];
+        for (int c = 2; c < channels; c++)
+            out[c] = 0.0;
+    }
+    *buf += channels;
+}
+
+// Renders frames interleaved frames into buf, in the format the engine was opened with.
+void engine_render(struct engine *e, long long *current_frame, int frames, float *buf, engine_input_cb input,
+                   void *arg)
+{
+    while (frames > 0)
+    {
+        float mix[ENGINE_BLOCK_FRAMES][2] = {};
+        int block_frames = min(frames, ENGINE_BLOCK_FRAMES);
+        struct render_params rp;
+        voice_kernel kernel;
+
+        // Cut the block short where the next input or step lands so it starts exactly on its frame. The input goes
+        // in before the block takes its parameters.
+        if (input)
+            block_frames = input(e, *current_frame, block_frames, arg);
+
+        freeze_params(e);
+        snapshot_params(e, &rp);
+        mod_block(&e->mod);
+        kernel = select_voice_kernel(e);
+
+        block_frames = sequencer_advance(&e->seq, *current_frame, block_frames,
+                                         sequencer_frames_per_step(e->p.bpm.block, e->sample_rate));
+        snapshot_ramps(e, &rp, block_frames);
+        // Ramps and control rate modulation move with the block, a replay renders the same blocks.
+        tap(e, ENGINE_BLOCK, block_frames, 0.0, *current_frame);
+
+        for (int i = 0; i < NBR_VOICES; i++)
+        {
+            if (e->voices[i].key != 0)
+                kernel(e, &e->voices[i], *current_frame, block_frames, mix, rp.pan_gain[i], &rp);
+        }
+
+        for (int s = 0; s < block_frames; s++)
+        {
+            render_effects(e, mix[s], *current_frame, s, block_frames, &rp);
+            write_frame(mix[s], &buf, e->channels);
+
+            *current_frame += 1;
+        }
+        frames -= block_frames;
+    }
+}
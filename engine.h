@@ -0,0 +1,123 @@
+#pragma once
+#include <stdbool.h>
+
+#include "delay.h"
+#include "envelope.h"
+#include "fm.h"
+#include "linear_control.h"
+#include "low_pass_filter.h"
+#include "mod.h"
+#include "osc.h"
+#include "ramp.h"
+#include "sequencer.h"
+#include "util.h"
+
+#define ENGINE_MAX_GROUPS (9)
+#define ENGINE_BLOCK_FRAMES (256)
+#define ENGINE_MAX_DELAY_MS (750)
+
+// A complete synth: voices, parameters, modulation, effects and sequencer. Nothing in it is shared with another
+// engine, so several can render side by side, on separate threads as long as each one has a single owner. The
+// engine_ functions expect the caller to be that owner.
+
+struct voice
+{
+    int key; // 0 is off, 1 is a C
+    float velocity;
+    long long released;
+    long long pressed;
+    struct env_state env;
+    struct filter_state filter;
+    struct osc_state osc;
+};
+
+struct engine_params
+{
+    struct ctrl_param amplitude;
+    struct ctrl_param octave;
+    struct ctrl_param osc_type;
+    struct ctrl_param cutoff;
+    struct ctrl_param resonance;
+    struct ctrl_param key_to_cutoff;
+    struct ctrl_param cutoff_lfo_freq;
+    struct ctrl_param cutoff_lfo_amp;
+    struct ctrl_param dist_level;
+    struct ctrl_param flip_level;
+    struct ctrl_param A;
+    struct ctrl_param D;
+    struct ctrl_param S;
+    struct ctrl_param R;
+    struct ctrl_param env_to_cutoff;
+    struct ctrl_param pan_spread;
+    struct ctrl_param env_to_amp;
+    struct ctrl_param delay_ms;
+    struct ctrl_param delay_fb;
+    struct ctrl_param chorus_amount;
+    struct ctrl_param chorus_freq;
+    struct ctrl_param bpm;
+    struct ctrl_param gate;
+
+    struct ctrl_param_group tone_ctrls;
+    struct ctrl_param_group envelope_ctrls;
+    struct ctrl_param_group filter_ctrls;
+    struct ctrl_param_group dist_ctrls;
+    struct ctrl_param_group delay_ctrls;
+    struct ctrl_param_group chorus_ctrls;
+    struct ctrl_param_group sequencer_ctrls;
+    struct ctrl_param_group *groups[ENGINE_MAX_GROUPS];
+};
+
+// What the engine was played, for whoever records it.
+enum engine_input
+{
+    ENGINE_NOTE_ON = 0,
+    ENGINE_NOTE_OFF,
+    ENGINE_CONTROL, // key is the controller number
+    ENGINE_BLOCK,   // key is the length of the block that starts at frame, once its parameters are taken
+};
+
+typedef void (*engine_tap_cb)(enum engine_input input, int key, float value, long long frame);
+
+struct engine
+{
+    int sample_rate;
+    int channels; // of the rendered frames, the first two are left and right
+    struct engine_params p;
+    struct voice voices[NBR_VOICES];
+    struct osc_params osc;
+    struct fm fm;
+    struct delay delay;
+    struct sequencer seq;
+
+    // The parameters that click or warble when they jump.
+    struct ramp_set ramps;
+    struct ramp amplitude_ramp;
+    struct ramp cutoff_ramp;
+    struct ramp delay_ms_ramp;
+    struct ramp delay_fb_ramp;
+
+    // Modulation destinations, as the voice kernels look them up.
+    struct mod_matrix mod;
+    int cutoff_dest;
+    int amplitude_dest;
+    int resonance_dest;
+
+    engine_tap_cb tap;
+};
+
+// Called at the start of every block, before any parameter is read, to play what is due at frame. Returns how many
+// of frames can be rendered before the next input is due.
+typedef int (*engine_input_cb)(struct engine *e, long long frame, int frames, void *arg);
+
+void engine_init(struct engine *e);
+int engine_open(struct engine *e, int sample_rate, int channels);
+void engine_close(struct engine *e);
+
+void engine_note_on(struct engine *e, int key, float velocity, long long frame);
+void engine_note_off(struct engine *e, int key, long long frame);
+void engine_control(struct engine *e, int number, int value, long long frame);
+void engine_all_notes_off(struct engine *e, long long frame);
+int engine_lowest_key(const struct engine *e);
+
+void engine_render(struct engine *e, long long *current_frame, int frames, float *buf, engine_input_cb input,
+                   void *arg);
@@ -1,4 +1,5 @@
 #include "envelope.h"
+#include "diag.h"
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -10,10 +11,10 @@ static float ms_to_frames(int sample_rate, float ms)
     return ms * sample_rate / 1000;
 }
 
-void envelope_init(struct env_state *state, SDL_AudioSpec *spec)
+void envelope_init(struct env_state *state, int sample_rate)
 {
 
-    state->sample_rate = spec->freq;
+    state->sample_rate = sample_rate;
     state->start_frame = -88200;
     state->release_frame = -44200;
     state->release_level = 0.5;
@@ -38,8 +39,8 @@ float envelope_get(struct env_state *state, float A, float D, float S, float R,
     float ret_level;
     if (frame < state->start_frame)
     {
-        printf("Bad startframe %lld or frame %lld\n", state->start_frame, frame);
-        exit(-1);
+        diag_post(DIAG_BAD_START_FRAME, state->start_frame, frame);
+        return 0.0;
     }
 
     if (state->start_frame >= state->release_frame)
@@ -0,0 +1,30 @@
+#include "event_queue.h"
+
+bool event_queue_push(struct event_queue *q, const struct synth_event *ev)
+{
+    unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+
+    if (head - tail == EVENT_QUEUE_LEN)
+        return false;
+    q->events[head % EVENT_QUEUE_LEN] = *ev;
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return true;
+}
+
+bool event_queue_peek(struct event_queue *q, struct synth_event *ev)
+{
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&q->head, memory_order_acquire);
+
+    if (head == tail)
+        return false;
+    *ev = q->events[tail % EVENT_QUEUE_LEN];
+    return true;
+}
+
+void event_queue_pop(struct event_queue *q)
+{
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+}
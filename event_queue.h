@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#define EVENT_QUEUE_LEN (1024) // power of two
+
+enum synth_event_type
+{
+    SYNTH_EVENT_NOTE_ON = 0,
+    SYNTH_EVENT_NOTE_OFF,
+    SYNTH_EVENT_CONTROL, // key is the controller number, value its value
+    SYNTH_EVENT_CLOCK_STEP, // value is the frames per step
+    SYNTH_EVENT_CLOCK,
+    SYNTH_EVENT_START,
+    SYNTH_EVENT_CONTINUE,
+    SYNTH_EVENT_STOP,
+    SYNTH_EVENT_SEQ_RUN, // from the ui, starts or stops the sequencer
+    SYNTH_EVENT_SEQ_INPUT, // from the ui, key and gate of the step at the sequencer's cursor
+    SYNTH_EVENT_NBR_OF,
+};
+
+struct synth_event
+{
+    long long frame; // applied when rendering reaches this frame, right away if it is already passed
+    enum synth_event_type type;
+    int channel; // MIDI channel, 0-15
+    int key;
+    float value;
+};
+
+// Single producer, single consumer. The audio thread is the consumer and never waits.
+struct event_queue
+{
+    struct synth_event events[EVENT_QUEUE_LEN];
+    atomic_uint head;
+    atomic_uint tail;
+};
+
+bool event_queue_push(struct event_queue *q, const struct synth_event *ev);
+bool event_queue_peek(struct event_queue *q, struct synth_event *ev);
+void event_queue_pop(struct event_queue *q);
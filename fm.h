@@ -1,19 +1,65 @@
 #pragma once
-#include <SDL3/SDL_audio.h>
-#include <SDL3/SDL_render.h>
 #include <stdbool.h>
 
+#include "linear_control.h"
+
+#define FM_NBR_OPS (8)
+#define FM_NBR_ALGOS (32)
+#define FM_MAX_GROUPS (FM_NBR_OPS + 2) // choose algo and # operators.
+
+enum op_param
+{
+    OP_PARAM_AMP = 0,
+    OP_PARAM_FREQ,
+    OP_PARAM_DETUNE,
+    OP_PARAM_A,
+    OP_PARAM_D,
+    OP_PARAM_S,
+    OP_PARAM_R,
+    OP_PARAM_NBR_OF,
+};
+
 struct fm_operator
 {
     float *amp;
     float *freq;
 };
 
-void fm_draw(SDL_Renderer *renderer);
-void fm_click(int x, int y);
-void fm_unclick();
-void fm_move(int x, int y);
-void fm_init(int x, int y);
-float fm_render_sample(long long current_frame, const SDL_AudioSpec *spec, float freq);
-bool fm_read_setting(char *line);
-void fm_save_settings(FILE *f);
+struct operator
+{
+    int input_ops[FM_NBR_OPS];
+    int feedback_op;
+    float last_value;
+};
+
+struct algorithm
+{
+    int nbr_carriers;
+    int carriers[FM_NBR_OPS];
+    struct operator ops[FM_NBR_OPS]; // this will host all the operators (except carriers) regardless of how they are
+                                     // connected. Index +1 will be op number
+};
+
+// One per engine, the algorithms keep the last value of every operator for feedback.
+struct fm
+{
+    struct ctrl_param algorithm;
+    struct ctrl_param ops[2 * OP_PARAM_NBR_OF * FM_NBR_OPS + 1];
+    struct ctrl_param_group algorithm_group;
+    struct ctrl_param_group ops_param_groups[FM_NBR_OPS];
+    struct ctrl_param_group *groups[FM_MAX_GROUPS];
+    struct algorithm algos[FM_NBR_ALGOS];
+};
+
+// The operator values a block is rendered with, taken once at its start.
+struct fm_block
+{
+    int algorithm;
+    float amp[FM_NBR_OPS];
+    float freq[FM_NBR_OPS];
+};
+
+void fm_init(struct fm *fm);
+void fm_snapshot(const struct fm *fm, struct fm_block *block);
+float fm_render_sample(struct fm *fm, const struct fm_block *block, long long current_frame, int sample_rate,
+                       float freq);
@@ -0,0 +1,166 @@
+#include "fm_ui.h"
+#include "linear_control.h"
+#include "slide_controller.h"
+#include "text.h"
+#include "ui.h"
+#include "util.h"
+
+#define OP_START_X 600
+#define OP_START_Y 250
+#define OP_WIDTH 30
+#define LINE_DISTANCE (5)
+
+// Room for the deepest operator chain above the carriers and the summing lines below them.
+#define GRAPH_TOP (OP_START_Y - 2 * OP_WIDTH * (FM_NBR_OPS - 1))
+#define GRAPH_AREA                                                                                                     \
+    ((SDL_FRect){OP_START_X - OP_WIDTH, max(0, GRAPH_TOP), 2 * OP_WIDTH * (FM_NBR_OPS + 1),                             \
+                 OP_START_Y + 2 * OP_WIDTH - max(0, GRAPH_TOP)})
+
+static void draw_graph(SDL_Renderer *renderer);
+static unsigned graph_state();
+
+// The engine the graph shows.
+static struct fm *shown = NULL;
+
+// Sliders and the algorithm graph for the engine that is shown.
+void fm_ui_init(struct fm *fm, int x_in, int y_in)
+{
+    shown = fm;
+
+    // Initialize all the actual controllers
+    {
+#define WIDTH (1024)
+#define HEIGHT (768)
+        int i = 0;
+        int j = 0;
+        struct ctrl_param_group *pg;
+        struct ctrl_param *p;
+        const int margin = 10;
+        const int width = 100;
+        const int height = 10;
+        int label_height = text_get_height();
+        int tot_height = height + label_height;
+        int x = margin;
+        int y = margin;
+        while ((pg = fm->groups[i++]))
+        {
+            j = 0;
+            while ((p = pg->params[j++]))
+            {
+                x = x_in + margin + (y + y_in) / (HEIGHT - tot_height) * (width + margin);
+                ui_add_slider(slide_controller_create(
+                                  x, (y + y_in) % (HEIGHT - tot_height), width, height,
+                                  (struct linear_control){&p->value, p->min, p->max, p->quantized_to_int}, p->label),
+                              UI_PANEL_FM);
+                y += (margin + height + label_height);
+            }
+            y += 3 * margin;
+        }
+    }
+
+    ui_add_custom(GRAPH_AREA, UI_PANEL_FM, draw_graph, graph_state);
+}
+
+float draw_operator(SDL_Renderer *renderer, struct algorithm *algo, int op, SDL_FPoint *op_positions, float left_most,
+                    float *right_most, float y)
+{
+    static SDL_FRect rect = {.w = OP_WIDTH, .h = OP_WIDTH};
+    float modulation = 0;
+    struct operator* op_p = & algo->ops[op - 1];
+
+    for (int i = 0; 0 != op_p->input_ops[i]; i++)
+    {
+        if (i > 0)
+            *right_most += OP_WIDTH * 2;
+        draw_operator(renderer, algo, op_p->input_ops[i], op_positions, *right_most, right_most, y - OP_WIDTH * 2);
+    }
+
+    float x = (left_most + *right_most) / 2;
+    op_positions[op - 1].x = x + OP_WIDTH / 2;
+    op_positions[op - 1].y = y;
+    rect.x = x;
+    rect.y = y;
+
+    char label[2] = {'0' + op, '\0'};
+    SDL_SetRenderDrawColor(renderer, 200, 0, 55, 255);
+    text_draw(renderer, label, x + OP_WIDTH / 2 - text_get_width() / 2, y + OP_WIDTH / 2 - text_get_height() / 2,
+              false);
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderRect(renderer, &rect);
+
+    return op_p->last_value;
+}
+
+void draw_operator_connections(SDL_Renderer *renderer, struct algorithm *algo, int op, SDL_FPoint *op_positions)
+{
+    float modulation = 0;
+    struct operator* op_p = & algo->ops[op - 1];
+
+    for (int i = 0; 0 != op_p->input_ops[i]; i++)
+    {
+        draw_operator_connections(renderer, algo, op_p->input_ops[i], op_positions);
+        SDL_FPoint tmp_points[2] = {op_positions[op - 1], op_positions[op_p->input_ops[i] - 1]};
+        tmp_points[1].y += OP_WIDTH;
+        SDL_RenderLines(renderer, tmp_points, 2);
+    }
+    if (op_p->feedback_op)
+    {
+        SDL_FPoint tmp_points[6] = {op_positions[op - 1],
+                                    op_positions[op - 1],
+                                    op_positions[op - 1],
+                                    op_positions[op_p->feedback_op - 1],
+                                    op_positions[op_p->feedback_op - 1],
+                                    op_positions[op_p->feedback_op - 1]};
+
+        tmp_points[1].y -= LINE_DISTANCE;
+
+        tmp_points[2].y -= LINE_DISTANCE;
+        tmp_points[2].x += OP_WIDTH / 2 + LINE_DISTANCE;
+
+        // this guy is special, since he should get x coord from one "port" and y coord from another
+        tmp_points[3].y += OP_WIDTH + LINE_DISTANCE;
+        tmp_points[3].x = tmp_points[2].x;
+        ;
+
+        tmp_points[4].y += OP_WIDTH + LINE_DISTANCE;
+        tmp_points[5].y += OP_WIDTH;
+
+        SDL_RenderLines(renderer, tmp_points, 6);
+    }
+}
+
+// The graph only depends on which algorithm is selected.
+static unsigned graph_state()
+{
+    return (unsigned)shown->algorithm.value;
+}
+
+static void draw_graph(SDL_Renderer *renderer)
+{
+    SDL_FPoint op_positions[FM_NBR_OPS];
+
+    struct algorithm *algo = &shown->algos[(int)shown->algorithm.value];
+    float right_most = OP_START_X;
+    for (int i = 0; i < algo->nbr_carriers; i++)
+    {
+        draw_operator(renderer, algo, algo->carriers[i], op_positions, right_most, &right_most, OP_START_Y);
+        right_most += OP_WIDTH * 2;
+
+        SDL_FPoint *pos = &op_positions[algo->carriers[i] - 1];
+        SDL_RenderLine(renderer, pos->x, pos->y + OP_WIDTH, pos->x, pos->y + OP_WIDTH + LINE_DISTANCE);
+        if (i == algo->nbr_carriers - 1)
+        {
+            SDL_FPoint *first_pos = &op_positions[algo->carriers[0] - 1];
+            SDL_FPoint *second_pos = &op_positions[algo->carriers[i] - 1];
+            SDL_RenderLine(renderer, first_pos->x, first_pos->y + OP_WIDTH + LINE_DISTANCE, second_pos->x,
+                           second_pos->y + OP_WIDTH + LINE_DISTANCE);
+            SDL_RenderLine(renderer, (first_pos->x + second_pos->x) / 2, first_pos->y + OP_WIDTH + LINE_DISTANCE,
+                           (first_pos->x + second_pos->x) / 2, first_pos->y + OP_WIDTH + 2 * LINE_DISTANCE);
+        }
+    }
+
+    for (int i = 0; i < algo->nbr_carriers; i++)
+    {
+        draw_operator_connections(renderer, algo, algo->carriers[i], op_positions);
+    }
+}
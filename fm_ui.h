@@ -0,0 +1,5 @@
+#pragma once
+
+#include "fm.h"
+
+void fm_ui_init(struct fm *fm, int x, int y);
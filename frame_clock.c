@@ -0,0 +1,69 @@
+#include <stdatomic.h>
+#include <time.h>
+
+#include "frame_clock.h"
+
+// Sequence lock, the writer bumps seq to odd before changing the pair and to even after.
+static atomic_uint seq = 0;
+static atomic_llong ref_frame = 0;
+static atomic_llong ref_ns = 0;
+
+static int rate = 44100;
+static int latency = 0;
+
+void frame_clock_init(int sample_rate, int latency_frames)
+{
+    rate = sample_rate;
+    latency = latency_frames;
+}
+
+long long frame_clock_now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ll + now.tv_nsec;
+}
+
+void frame_clock_update(long long playing_frame)
+{
+    long long now = frame_clock_now_ns();
+    unsigned s = atomic_load_explicit(&seq, memory_order_relaxed);
+
+    atomic_store_explicit(&seq, s + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&ref_frame, playing_frame, memory_order_relaxed);
+    atomic_store_explicit(&ref_ns, now, memory_order_relaxed);
+    atomic_store_explicit(&seq, s + 2, memory_order_release);
+}
+
+static void read_reference(long long *frame, long long *ns)
+{
+    unsigned s;
+
+    do
+    {
+        s = atomic_load_explicit(&seq, memory_order_acquire);
+        *frame = atomic_load_explicit(&ref_frame, memory_order_relaxed);
+        *ns = atomic_load_explicit(&ref_ns, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((s & 1) || s != atomic_load_explicit(&seq, memory_order_relaxed));
+}
+
+// Events are delayed by a fixed latency that covers everything already queued for the device, so an event is never
+// late and always arrives with the same delay.
+long long frame_clock_frame_at(long long ns)
+{
+    long long frame, at_ns;
+
+    read_reference(&frame, &at_ns);
+    return frame + (ns - at_ns) * rate / 1000000000ll + latency;
+}
+
+// The inverse, when a frame rendered now will be heard.
+long long frame_clock_ns_at(long long frame)
+{
+    long long at_frame, ns;
+
+    read_reference(&at_frame, &ns);
+    return ns + (frame - at_frame) * 1000000000ll / rate;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+// Relates CLOCK_MONOTONIC to the audio frame counter. The audio thread publishes which frame the device is
+// playing right now, other threads use that to turn a timestamp into the frame it should be rendered at.
+
+void frame_clock_init(int sample_rate, int latency_frames);
+void frame_clock_update(long long playing_frame);
+long long frame_clock_now_ns();
+long long frame_clock_frame_at(long long ns);
+long long frame_clock_ns_at(long long frame);
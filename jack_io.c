@@ -0,0 +1,165 @@
+#include <jack/jack.h>
+#include <jack/midiport.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "jack_io.h"
+#include "realtime.h"
+#include "rt_check.h"
+
+static jack_client_t *client = NULL;
+static jack_port_t *out_ports[JACK_IO_MAX_CHANNELS];
+static jack_port_t *midi_port;
+static struct midi_parser parser;
+static struct jack_io_config config;
+static float *buf; // interleaved, one period
+
+static int alloc_buffer(jack_nframes_t frames)
+{
+    free(buf);
+    buf = malloc(frames * config.channels * sizeof(float));
+    if (!buf)
+    {
+        fprintf(stderr, "%s: Failed to allocate %u frames\n", __func__, frames);
+        return -1;
+    }
+    return 0;
+}
+
+static void midi_in(jack_nframes_t frames)
+{
+    void *port_buf = jack_port_get_buffer(midi_port, frames);
+    jack_nframes_t n = jack_midi_get_event_count(port_buf);
+    jack_midi_event_t ev;
+    struct midi_message msg;
+
+    for (jack_nframes_t i = 0; i < n; i++)
+    {
+        if (jack_midi_event_get(&ev, port_buf, i))
+            continue;
+        for (size_t b = 0; b < ev.size; b++)
+        {
+            if (midi_parse_byte(&parser, ev.buffer[b], &msg))
+                config.midi_cb(&msg, ev.time, config.arg);
+        }
+    }
+}
+
+static int process(jack_nframes_t frames, void *arg)
+{
+    rt_check_enter();
+    midi_in(frames);
+    config.render_cb(buf, frames, config.arg);
+
+    for (int c = 0; c < config.channels; c++)
+    {
+        jack_default_audio_sample_t *out = jack_port_get_buffer(out_ports[c], frames);
+        for (jack_nframes_t s = 0; s < frames; s++)
+            out[s] = buf[s * config.channels + c];
+    }
+    rt_check_leave();
+    return 0;
+}
+
+// Called with the process callback stopped.
+static int buffer_size(jack_nframes_t frames, void *arg)
+{
+    return alloc_buffer(frames);
+}
+
+static void thread_init(void *arg)
+{
+    realtime_thread_enter();
+}
+
+static void server_shutdown(void *arg)
+{
+    fprintf(stderr, "%s: JACK server shut down\n", __func__);
+    if (config.shutdown_cb)
+        config.shutdown_cb(config.arg);
+}
+
+// Connects to a running server, jackd is never started from here. The sample rate and period size are the server's.
+int jack_io_open(const struct jack_io_config *c, int *sample_rate, int *period_frames)
+{
+    jack_status_t status;
+    char name[16];
+    bool registered;
+
+    config = *c;
+    if (config.channels < 1 || config.channels > JACK_IO_MAX_CHANNELS)
+    {
+        fprintf(stderr, "%s: Bad channel count %d\n", __func__, config.channels);
+        return -1;
+    }
+
+    client = jack_client_open(config.name, JackNoStartServer, &status);
+    if (!client)
+    {
+        fprintf(stderr, "%s: Can not connect to the JACK server, status 0x%x\n", __func__, status);
+        return -1;
+    }
+
+    midi_port = jack_port_register(client, "midi_in", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
+    registered = midi_port != NULL;
+    for (int i = 0; i < config.channels; i++)
+    {
+        snprintf(name, sizeof(name), "out_%d", i + 1);
+        out_ports[i] = jack_port_register(client, name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+        registered = registered && out_ports[i];
+    }
+    if (!registered)
+    {
+        fprintf(stderr, "%s: Failed to register the ports\n", __func__);
+        jack_io_stop();
+        return -1;
+    }
+
+    midi_parser_init(&parser);
+    *sample_rate = jack_get_sample_rate(client);
+    *period_frames = jack_get_buffer_size(client);
+    if (alloc_buffer(*period_frames))
+    {
+        jack_io_stop();
+        return -1;
+    }
+
+    jack_set_process_callback(client, process, NULL);
+    jack_set_buffer_size_callback(client, buffer_size, NULL);
+    jack_set_thread_init_callback(client, thread_init, NULL);
+    jack_on_shutdown(client, server_shutdown, NULL);
+    return 0;
+}
+
+int jack_io_start()
+{
+    const char **ports;
+
+    if (jack_activate(client))
+    {
+        fprintf(stderr, "%s: Failed to activate the client\n", __func__);
+        return -1;
+    }
+    if (!config.connect)
+        return 0;
+
+    ports = jack_get_ports(client, NULL, JACK_DEFAULT_AUDIO_TYPE, JackPortIsPhysical | JackPortIsInput);
+    for (int i = 0; ports && ports[i] && i < config.channels; i++)
+    {
+        if (jack_connect(client, jack_port_name(out_ports[i]), ports[i]))
+            fprintf(stderr, "%s: Failed to connect to %s\n", __func__, ports[i]);
+    }
+    jack_free(ports);
+    return 0;
+}
+
+void jack_io_stop()
+{
+    if (!client)
+        return;
+    jack_deactivate(client);
+    jack_client_close(client);
+    client = NULL;
+    free(buf);
+    buf = NULL;
+}
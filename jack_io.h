@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "midi.h"
+
+#define JACK_IO_MAX_CHANNELS (2)
+
+// Audio and MIDI through a JACK client. The synth renders inside the process callback, in the period size JACK
+// runs with, and MIDI from the input port arrives with its frame offset into that period.
+
+// MIDI from the input port, offset frames into the period that is about to be rendered.
+typedef void (*jack_io_midi_cb)(const struct midi_message *msg, int offset, void *arg);
+// Renders frames interleaved frames into buf.
+typedef void (*jack_io_render_cb)(float *buf, int frames, void *arg);
+
+struct jack_io_config
+{
+    const char *name; // of the client
+    int channels;     // output ports
+    bool connect;     // to the physical playback ports
+    jack_io_midi_cb midi_cb;
+    jack_io_render_cb render_cb;
+    void (*shutdown_cb)(void *arg); // the server went away
+    void *arg;
+};
+
+int jack_io_open(const struct jack_io_config *config, int *sample_rate, int *period_frames);
+int jack_io_start();
+void jack_io_stop();
@@ -0,0 +1,281 @@
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "diag.h"
+#include "journal.h"
+#include "param.h"
+#include "util.h"
+
+#define MAGIC "SYN1JRNL"
+#define VERSION (3)
+#define MAX_PARAMS (256)
+#define RING_LEN (4096) // power of two
+#define WRITE_INTERVAL_NS (50000000)
+
+// Start of the file, followed by the param_id of every parameter, and then the records. Everything is in host byte
+// order.
+struct journal_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t sample_rate;
+    uint32_t channels;
+    uint32_t nbr_params;
+};
+
+// RECORDING, the only producer is the thread that renders the first part, so one writer index is enough.
+static FILE *file = NULL;
+static int nbr_params = 0;
+static float recorded[MAX_PARAMS];
+static struct journal_record ring[RING_LEN];
+static atomic_uint head = 0;
+static atomic_uint tail = 0;
+static atomic_uint dropped = 0;
+static atomic_bool recording = false;
+static pthread_t writer_thread;
+
+// REPLAY
+static struct journal_record *records = NULL;
+static int nbr_records = 0;
+static int next_record = 0;
+static param_id file_ids[MAX_PARAMS];
+static struct ctrl_param *param_map[MAX_PARAMS]; // by file index, NULL for parameters this build does not have
+static int nbr_file_params = 0;
+static bool mapped = false;
+static long long end_frame = 0;
+
+void journal_record(enum journal_type type, int key, float value, long long frame)
+{
+    unsigned h, t;
+
+    if (!atomic_load_explicit(&recording, memory_order_relaxed))
+        return;
+
+    h = atomic_load_explicit(&head, memory_order_relaxed);
+    t = atomic_load_explicit(&tail, memory_order_acquire);
+    if (h - t == RING_LEN)
+    {
+        // Full, never wait for the writer.
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        return;
+    }
+    ring[h % RING_LEN] = (struct journal_record){.frame = frame, .type = type, .key = key, .value = value};
+    atomic_store_explicit(&head, h + 1, memory_order_release);
+}
+
+// Records every parameter that changed since the last block, as the renderer took it for this one, and the block.
+// Called once the block's parameters and length are settled.
+void journal_block(long long frame, int frames)
+{
+    if (!atomic_load_explicit(&recording, memory_order_relaxed))
+        return;
+
+    for (int i = 0; i < nbr_params; i++)
+    {
+        float v = param_at(i)->block;
+        if (v != recorded[i])
+        {
+            recorded[i] = v;
+            journal_record(JOURNAL_PARAM, i, v, frame);
+        }
+    }
+    journal_record(JOURNAL_BLOCK, frames, 0.0, frame);
+}
+
+static void write_records()
+{
+    static unsigned reported_dropped = 0;
+    static long long written = 0;
+    static bool failed = false;
+    bool failed_before = failed;
+    unsigned t = atomic_load_explicit(&tail, memory_order_relaxed);
+    unsigned h = atomic_load_explicit(&head, memory_order_acquire);
+
+    while (t != h)
+    {
+        // Up to the end of the ring in one go. After a failed write the records are only consumed, the journal
+        // ends where it failed.
+        unsigned n = min(h - t, RING_LEN - t % RING_LEN);
+        if (!failed)
+        {
+            size_t w = fwrite(&ring[t % RING_LEN], sizeof(*ring), n, file);
+            written += w;
+            failed = w < n;
+        }
+        t += n;
+    }
+    atomic_store_explicit(&tail, t, memory_order_release);
+    if (!failed && fflush(file))
+        failed = true;
+    if (failed && !failed_before)
+        diag_post(DIAG_JOURNAL_WRITE_FAILED, errno, written);
+
+    unsigned d = atomic_load_explicit(&dropped, memory_order_relaxed);
+    if (d != reported_dropped)
+    {
+        fprintf(stderr, "%u journal records dropped, replay will differ\n", d - reported_dropped);
+        reported_dropped = d;
+    }
+}
+
+static void *writer_loop(void *arg)
+{
+    struct timespec interval = {.tv_nsec = WRITE_INTERVAL_NS};
+    while (atomic_load(&recording))
+    {
+        write_records();
+        nanosleep(&interval, NULL);
+    }
+    write_records();
+    return NULL;
+}
+
+int journal_start(const char *filename, int sample_rate, int channels)
+{
+    struct journal_header header = {.version = VERSION, .sample_rate = sample_rate, .channels = channels};
+
+    if (!(file = fopen(filename, "wb")))
+    {
+        perror("Failed to open journal!");
+        return -1;
+    }
+
+    memcpy(header.magic, MAGIC, sizeof(header.magic));
+    nbr_params = min(param_count(), MAX_PARAMS);
+    header.nbr_params = nbr_params;
+    fwrite(&header, sizeof(header), 1, file);
+    for (int i = 0; i < nbr_params; i++)
+    {
+        param_id id = param_id_at(i);
+        fwrite(&id, sizeof(id), 1, file);
+        recorded[i] = NAN; // so the first block records every starting value
+    }
+
+    atomic_store(&recording, true);
+    if (pthread_create(&writer_thread, NULL, writer_loop, NULL))
+    {
+        perror("Failed to create journal thread!");
+        atomic_store(&recording, false);
+        fclose(file);
+        file = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void journal_stop(long long frame)
+{
+    if (!file)
+        return;
+    journal_record(JOURNAL_END, 0, 0.0, frame);
+    atomic_store(&recording, false);
+    pthread_join(writer_thread, NULL);
+    if (fclose(file))
+        perror("Failed to write journal!");
+    file = NULL;
+}
+
+int journal_replay_load(const char *filename, int *sample_rate, int *channels)
+{
+    struct journal_header header;
+    FILE *f = fopen(filename, "rb");
+    long size;
+
+    if (!f)
+    {
+        fprintf(stderr, "%s: failed to open \"%s\"\n", __func__, filename);
+        return -1;
+    }
+    if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, MAGIC, sizeof(header.magic)) ||
+        header.version != VERSION || header.nbr_params > MAX_PARAMS)
+    {
+        fprintf(stderr, "%s: \"%s\" is not a journal\n", __func__, filename);
+        fclose(f);
+        return -1;
+    }
+
+    nbr_file_params = fread(file_ids, sizeof(*file_ids), header.nbr_params, f);
+    mapped = false;
+
+    long start = ftell(f);
+    fseek(f, 0, SEEK_END);
+    size = ftell(f) - start;
+    fseek(f, start, SEEK_SET);
+    free(records);
+    records = malloc(size);
+    nbr_records = records ? fread(records, sizeof(*records), size / sizeof(*records), f) : 0;
+    fclose(f);
+
+    next_record = 0;
+    end_frame = 0;
+    for (int i = 0; i < nbr_records; i++)
+        end_frame = max(end_frame, (long long)records[i].frame);
+
+    *sample_rate = header.sample_rate;
+    *channels = header.channels;
+    printf("%s: %d records, %lld frames\n", filename, nbr_records, end_frame);
+    return 0;
+}
+
+// Not every module has registered its parameters when the journal is loaded, so the ids are looked up on the first
+// block instead.
+static void map_params()
+{
+    for (int i = 0; i < nbr_file_params; i++)
+    {
+        if (!(param_map[i] = param_get(file_ids[i])))
+            fprintf(stderr, "%s: unknown parameter %08x is ignored\n", __func__, file_ids[i]);
+    }
+    mapped = true;
+}
+
+long long journal_replay_length()
+{
+    return end_frame;
+}
+
+// Called by the renderer at the start of every block, before the parameters are taken. Applies the parameters and
+// hands on the notes and controllers due at frame, and returns how many frames can be rendered before the next
+// record. The next block record ends the block where it ended when it was recorded.
+int journal_replay_advance(long long frame, int frames, journal_play_cb cb)
+{
+    if (!mapped)
+        map_params();
+    for (; next_record < nbr_records; next_record++)
+    {
+        const struct journal_record *rec = &records[next_record];
+        if (rec->frame > frame)
+            return min((long long)frames, rec->frame - frame);
+
+        if (rec->type == JOURNAL_PARAM)
+        {
+            if (rec->key < nbr_file_params && param_map[rec->key])
+                param_map[rec->key]->value = rec->value;
+        }
+        else if (rec->type != JOURNAL_END && rec->type != JOURNAL_BLOCK)
+        {
+            cb(rec, frame);
+        }
+    }
+    return frames;
+}
+
+// Returns how many of frames to render in one go from frame so that the last block ends where it ended when it was
+// recorded. The renderer can only cut blocks shorter, never join them across two calls.
+int journal_replay_chunk(long long frame, int frames)
+{
+    long long end = frame;
+
+    for (int i = next_record; i < nbr_records && records[i].frame <= frame + frames; i++)
+    {
+        if (records[i].type == JOURNAL_BLOCK)
+            end = records[i].frame;
+    }
+    return end > frame ? end - frame : frames;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Records what the engine was fed, voice by voice and parameter by parameter, with the frame it happened at, and
+// where each block started. The audio side only fills a lock-free ring, a low priority thread writes it out. A
+// recording replayed offline feeds the engine the same input on the same frames, in the same blocks.
+
+enum journal_type
+{
+    JOURNAL_NOTE_ON = 0,
+    JOURNAL_NOTE_OFF,
+    JOURNAL_CONTROL, // key is the controller number
+    JOURNAL_PARAM,   // key is the index of the parameter in the file header
+    JOURNAL_END,     // last frame that was rendered
+    JOURNAL_BLOCK,   // key is the length of the block the renderer started at frame
+    JOURNAL_TYPE_COUNT,
+};
+
+// As stored in the file.
+struct journal_record
+{
+    int64_t frame;
+    uint16_t type;
+    uint16_t key;
+    float value;
+};
+
+typedef void (*journal_play_cb)(const struct journal_record *rec, long long frame);
+
+int journal_start(const char *filename, int sample_rate, int channels);
+void journal_stop(long long frame);
+void journal_record(enum journal_type type, int key, float value, long long frame);
+void journal_block(long long frame, int frames);
+
+int journal_replay_load(const char *filename, int *sample_rate, int *channels);
+long long journal_replay_length();
+int journal_replay_advance(long long frame, int frames, journal_play_cb cb);
+int journal_replay_chunk(long long frame, int frames);
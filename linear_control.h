@@ -14,8 +14,9 @@ struct linear_control
 
 struct ctrl_param
 {
-    char label[15];
+    char label[32];
     float value;
+    float block; // value as the block being rendered took it, only the renderer writes it
     float min;
     float max;
     bool quantized_to_int;
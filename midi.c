@@ -1,99 +1,427 @@
 #include <alsa/asoundlib.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
 
 #include "midi.h"
+#include "util.h"
 
-snd_rawmidi_t *midi_start()
+#define MIDI_POLL_TIMEOUT_MS (100)
+#define MIDI_OUT_POLL_TIMEOUT_MS (2) // outgoing messages are picked up this often, well within the audio latency
+#define MAX_SEQ_FDS (4)
+
+static snd_seq_t *seq = NULL;
+static int queue = -1;
+static int port = -1;
+static pthread_t midi_tid;
+static volatile bool midi_running = false;
+static struct midi_config config;
+
+static long long monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ll + now.tv_nsec;
+}
+
+// Offset from queue time to CLOCK_MONOTONIC. The queue runs on its own timer, so this is taken again for every
+// batch of events instead of once at start.
+static long long queue_to_monotonic_ns()
 {
-    int fd;
+    snd_seq_queue_status_t *status;
+    const snd_seq_real_time_t *t;
 
-    snd_rawmidi_t *inputp;
-    if (0 < (fd = snd_rawmidi_open(&inputp, NULL, "virtual", SND_RAWMIDI_NONBLOCK)))
+    snd_seq_queue_status_alloca(&status);
+    if (snd_seq_get_queue_status(seq, queue, status) < 0)
+        return 0;
+    t = snd_seq_queue_status_get_real_time(status);
+    return monotonic_ns() - (t->tv_sec * 1000000000ll + t->tv_nsec);
+}
 
+static bool to_message(const snd_seq_event_t *ev, struct midi_message *msg)
+{
+    msg->channel = 0;
+    switch (ev->type)
     {
-        fprintf(stderr, "open error: %d - %s\n", (int)fd, snd_strerror(fd));
-        return NULL;
+    case SND_SEQ_EVENT_NOTEON:
+        msg->type = ev->data.note.velocity == 0 ? MIDI_MSG_NOTE_OFF : MIDI_MSG_NOTE_ON;
+        msg->channel = ev->data.note.channel;
+        msg->note.key = ev->data.note.note;
+        msg->note.velocity = 1.0 * ev->data.note.velocity / 127;
+        return true;
+    case SND_SEQ_EVENT_NOTEOFF:
+        msg->type = MIDI_MSG_NOTE_OFF;
+        msg->channel = ev->data.note.channel;
+        msg->note.key = ev->data.note.note;
+        msg->note.velocity = 1.0 * ev->data.note.velocity / 127;
+        return true;
+    case SND_SEQ_EVENT_KEYPRESS:
+        msg->type = MIDI_MSG_POLY_AFTERTOUCH;
+        msg->channel = ev->data.note.channel;
+        msg->note.key = ev->data.note.note;
+        msg->note.velocity = 1.0 * ev->data.note.velocity / 127;
+        return true;
+    case SND_SEQ_EVENT_CONTROLLER:
+        msg->type = MIDI_MSG_CONTROL_CHANGE;
+        msg->channel = ev->data.control.channel;
+        msg->control.number = ev->data.control.param;
+        msg->control.value = ev->data.control.value;
+        return true;
+    case SND_SEQ_EVENT_PGMCHANGE:
+        msg->type = MIDI_MSG_PROGRAM_CHANGE;
+        msg->channel = ev->data.control.channel;
+        msg->program = ev->data.control.value;
+        return true;
+    case SND_SEQ_EVENT_CHANPRESS:
+        msg->type = MIDI_MSG_CHANNEL_AFTERTOUCH;
+        msg->channel = ev->data.control.channel;
+        msg->pressure = 1.0 * ev->data.control.value / 127;
+        return true;
+    case SND_SEQ_EVENT_PITCHBEND:
+        msg->type = MIDI_MSG_PITCH_BEND;
+        msg->channel = ev->data.control.channel;
+        msg->bend = ev->data.control.value / 8192.0;
+        return true;
+    case SND_SEQ_EVENT_CLOCK:
+        msg->type = MIDI_MSG_CLOCK;
+        return true;
+    case SND_SEQ_EVENT_START:
+        msg->type = MIDI_MSG_START;
+        return true;
+    case SND_SEQ_EVENT_CONTINUE:
+        msg->type = MIDI_MSG_CONTINUE;
+        return true;
+    case SND_SEQ_EVENT_STOP:
+        msg->type = MIDI_MSG_STOP;
+        return true;
+    case SND_SEQ_EVENT_SENSING:
+        msg->type = MIDI_MSG_ACTIVE_SENSING;
+        return true;
+    case SND_SEQ_EVENT_RESET:
+        msg->type = MIDI_MSG_RESET;
+        return true;
+    default:
+        return false;
     }
-    else
+}
+
+static void read_events()
+{
+    snd_seq_event_t *ev;
+    struct midi_message msg;
+    long long offset = queue_to_monotonic_ns();
+
+    while (snd_seq_event_input(seq, &ev) >= 0)
     {
-        return inputp;
+        if (ev->queue == queue && to_message(ev, &msg))
+        {
+            long long ns = ev->time.time.tv_sec * 1000000000ll + ev->time.time.tv_nsec + offset;
+            config.event_cb(&msg, ns, config.arg);
+        }
     }
 }
 
-void midi_stop(snd_rawmidi_t *inputp)
+static bool to_seq_event(const struct midi_message *msg, snd_seq_event_t *ev)
 {
-    snd_rawmidi_close(inputp);
+    switch (msg->type)
+    {
+    case MIDI_MSG_CLOCK:
+        ev->type = SND_SEQ_EVENT_CLOCK;
+        return true;
+    case MIDI_MSG_START:
+        ev->type = SND_SEQ_EVENT_START;
+        return true;
+    case MIDI_MSG_CONTINUE:
+        ev->type = SND_SEQ_EVENT_CONTINUE;
+        return true;
+    case MIDI_MSG_STOP:
+        ev->type = SND_SEQ_EVENT_STOP;
+        return true;
+    default:
+        return false;
+    }
 }
 
-bool midi_get(snd_rawmidi_t *inputp, struct midi_message *msg)
+// Schedules the outgoing messages on the queue, so the kernel sends each one at its time and not when this thread
+// happened to get to it.
+static void send_events()
 {
-    unsigned char byte;
-    static enum midi_msg_type status = MIDI_MSG_NONE;
-    static unsigned bytes_read = 0;
+    struct midi_message msg;
+    long long ns;
+    long long offset = 0;
+    bool sent = false;
 
-    if (inputp == NULL)
-        return NULL;
+    while (config.out_cb(&msg, &ns, config.arg))
+    {
+        snd_seq_event_t ev;
+        snd_seq_real_time_t t;
+        long long queue_ns;
 
-    ssize_t ret;
-    while (true)
+        snd_seq_ev_clear(&ev);
+        if (!to_seq_event(&msg, &ev))
+            continue;
+        if (!sent)
+            offset = queue_to_monotonic_ns();
+        queue_ns = max(0ll, ns - offset);
+        t.tv_sec = queue_ns / 1000000000ll;
+        t.tv_nsec = queue_ns % 1000000000ll;
+        snd_seq_ev_set_source(&ev, port);
+        snd_seq_ev_set_subs(&ev);
+        snd_seq_ev_schedule_real(&ev, queue, 0, &t);
+        snd_seq_event_output(seq, &ev);
+        sent = true;
+    }
+    if (sent)
+        snd_seq_drain_output(seq);
+}
+
+static void *midi_thread(void *arg)
+{
+    struct pollfd fds[MAX_SEQ_FDS];
+    int nfds = min(MAX_SEQ_FDS, snd_seq_poll_descriptors_count(seq, POLLIN));
+    int timeout = config.out_cb ? MIDI_OUT_POLL_TIMEOUT_MS : MIDI_POLL_TIMEOUT_MS;
+
+    nfds = snd_seq_poll_descriptors(seq, fds, nfds, POLLIN);
+    while (midi_running)
     {
-        ret = snd_rawmidi_read(inputp, &byte, 1);
-        if (ret == 0)
+        if (config.out_cb)
+            send_events();
+
+        if (poll(fds, nfds, timeout) < 0)
         {
-            return false;
+            if (errno == EINTR)
+                continue;
+            perror("MIDI poll failed!");
+            break;
         }
-        else if (ret < 0)
+        for (int i = 0; i < nfds; i++)
         {
-            if (ret != -EAGAIN)
+            if (fds[i].revents & POLLIN)
             {
-                fprintf(stderr, "read error: %d - %s\n", (int)ret, snd_strerror(ret));
+                read_events();
+                break;
             }
-            return false;
         }
-        else if (byte & 0x80) // STATUS BYTE
+    }
+    return NULL;
+}
+
+static int create_port()
+{
+    snd_seq_port_info_t *info;
+
+    snd_seq_port_info_alloca(&info);
+    snd_seq_port_info_set_name(info, "Synth One");
+    snd_seq_port_info_set_capability(info, SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE |
+                                               SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ);
+    snd_seq_port_info_set_type(info, SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+    // Let the kernel stamp every event with the queue time when it arrives.
+    snd_seq_port_info_set_timestamping(info, 1);
+    snd_seq_port_info_set_timestamp_real(info, 1);
+    snd_seq_port_info_set_timestamp_queue(info, queue);
+    if (snd_seq_create_port(seq, info) < 0)
+        return -1;
+    return snd_seq_port_info_get_port(info);
+}
+
+// Opens a sequencer client with one port that anyone can connect to, and connects it from each of the input ports
+// and to each of the output ports. Events are delivered to the callback from a thread of its own.
+int midi_start(const struct midi_config *midi_config)
+{
+    int err;
+
+    if ((err = snd_seq_open(&seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK)) < 0)
+    {
+        fprintf(stderr, "%s: open error: %d - %s\n", __func__, err, snd_strerror(err));
+        seq = NULL;
+        return -1;
+    }
+    snd_seq_set_client_name(seq, "Synth One");
+
+    if ((queue = snd_seq_alloc_named_queue(seq, "Synth One")) < 0 || (port = create_port()) < 0)
+    {
+        fprintf(stderr, "%s: could not create input port\n", __func__);
+        snd_seq_close(seq);
+        seq = NULL;
+        return -1;
+    }
+    snd_seq_start_queue(seq, queue, NULL);
+    snd_seq_drain_output(seq);
+
+    config = *midi_config;
+    for (int i = 0; i < config.nbr_in_ports; i++)
+    {
+        snd_seq_addr_t addr;
+        if (snd_seq_parse_address(seq, &addr, config.in_ports[i]) < 0 ||
+            snd_seq_connect_from(seq, port, addr.client, addr.port) < 0)
+            fprintf(stderr, "%s: could not connect from %s\n", __func__, config.in_ports[i]);
+    }
+    for (int i = 0; i < config.nbr_out_ports; i++)
+    {
+        snd_seq_addr_t addr;
+        if (snd_seq_parse_address(seq, &addr, config.out_ports[i]) < 0 ||
+            snd_seq_connect_to(seq, port, addr.client, addr.port) < 0)
+            fprintf(stderr, "%s: could not connect to %s\n", __func__, config.out_ports[i]);
+    }
+
+    midi_running = true;
+    if (pthread_create(&midi_tid, NULL, midi_thread, NULL))
+    {
+        perror("Failed to create MIDI thread!");
+        midi_running = false;
+        snd_seq_close(seq);
+        seq = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void midi_stop()
+{
+    if (!seq)
+        return;
+    midi_running = false;
+    pthread_join(midi_tid, NULL);
+    snd_seq_free_queue(seq, queue);
+    snd_seq_close(seq);
+    seq = NULL;
+}
+
+void midi_parser_init(struct midi_parser *parser)
+{
+    memset(parser, 0, sizeof(*parser));
+}
+
+// Number of data bytes that follow a status byte.
+static int data_len(unsigned char status)
+{
+    switch (status & 0xF0)
+    {
+    case 0xC0: // program change
+    case 0xD0: // channel aftertouch
+        return 1;
+    case 0xF0:
+        if (status == 0xF1 || status == 0xF3) // time code quarter frame, song select
+            return 1;
+        if (status == 0xF2) // song position
+            return 2;
+        return 0;
+    default:
+        return 2;
+    }
+}
+
+static bool realtime_message(unsigned char byte, struct midi_message *msg)
+{
+    msg->channel = 0;
+    switch (byte)
+    {
+    case 0xF8:
+        msg->type = MIDI_MSG_CLOCK;
+        return true;
+    case 0xFA:
+        msg->type = MIDI_MSG_START;
+        return true;
+    case 0xFB:
+        msg->type = MIDI_MSG_CONTINUE;
+        return true;
+    case 0xFC:
+        msg->type = MIDI_MSG_STOP;
+        return true;
+    case 0xFE:
+        msg->type = MIDI_MSG_ACTIVE_SENSING;
+        return true;
+    case 0xFF:
+        msg->type = MIDI_MSG_RESET;
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool channel_message(unsigned char status, const unsigned char *data, struct midi_message *msg)
+{
+    msg->channel = status & 0x0F;
+    switch (status & 0xF0)
+    {
+    case 0x80:
+        msg->type = MIDI_MSG_NOTE_OFF;
+        msg->note.key = data[0];
+        msg->note.velocity = 1.0 * data[1] / 127;
+        return true;
+    case 0x90:
+        // Note on with zero velocity is how running status streams turn notes off.
+        msg->type = data[1] == 0 ? MIDI_MSG_NOTE_OFF : MIDI_MSG_NOTE_ON;
+        msg->note.key = data[0];
+        msg->note.velocity = 1.0 * data[1] / 127;
+        return true;
+    case 0xA0:
+        msg->type = MIDI_MSG_POLY_AFTERTOUCH;
+        msg->note.key = data[0];
+        msg->note.velocity = 1.0 * data[1] / 127;
+        return true;
+    case 0xB0:
+        msg->type = MIDI_MSG_CONTROL_CHANGE;
+        msg->control.number = data[0];
+        msg->control.value = data[1];
+        return true;
+    case 0xC0:
+        msg->type = MIDI_MSG_PROGRAM_CHANGE;
+        msg->program = data[0];
+        return true;
+    case 0xD0:
+        msg->type = MIDI_MSG_CHANNEL_AFTERTOUCH;
+        msg->pressure = 1.0 * data[0] / 127;
+        return true;
+    case 0xE0:
+        msg->type = MIDI_MSG_PITCH_BEND;
+        msg->bend = ((data[0] | (data[1] << 7)) - 8192) / 8192.0;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Feeds one byte to the parser. Returns true and fills msg when the byte completed a message.
+bool midi_parse_byte(struct midi_parser *parser, unsigned char byte, struct midi_message *msg)
+{
+    if (byte >= 0xF8) // REALTIME, may show up anywhere, even inside other messages
+    {
+        return realtime_message(byte, msg);
+    }
+    else if (byte & 0x80) // STATUS BYTE
+    {
+        parser->nbr_data = 0;
+        parser->in_sysex = byte == 0xF0;
+        if (byte == 0xF0 || byte == 0xF7)
         {
-            if ((byte >> 4) == 0x9) // nOTE on, any channel
-            {
-                msg->type = status = MIDI_MSG_NOTE_ON;
-            }
-            else if ((byte >> 4) == 0x8) // nOTE off, any channel
-            {
-                msg->type = status = MIDI_MSG_NOTE_OFF;
-            }
-            else
-            {
-                status = MIDI_MSG_NONE;
-            }
-            bytes_read = 0;
+            parser->status = 0;
         }
-        else // DATA BYTE
+        else
         {
-            switch (status)
-            {
-            case MIDI_MSG_NOTE_ON:
-            case MIDI_MSG_NOTE_OFF:
-                if (bytes_read == 1)
-                {
-                    if (byte == 0)
-                        msg->type = MIDI_MSG_NOTE_OFF;
-                    else
-                        msg->note.velocity = 1.0 * byte / 127;
-                    bytes_read = 0;
-                    return true;
-                }
-                else if (bytes_read == 0)
-                {
-                    msg->note.key = byte;
-                    bytes_read++;
-                }
-                else
-                {
-                    fprintf(stderr, "wrong byte count!\n");
-                    return false;
-                }
-                break;
-            default:
-                // Data regarding a status type not yet implemented
-            }
+            parser->status = byte;
+            // Complete system common messages without data, they cancel running status.
+            if (data_len(byte) == 0)
+                parser->status = 0;
         }
+        return false;
+    }
+
+    // DATA BYTE
+    if (parser->in_sysex || parser->status == 0)
+        return false;
+
+    parser->data[parser->nbr_data++] = byte;
+    if (parser->nbr_data < data_len(parser->status))
+        return false;
+
+    parser->nbr_data = 0;
+    if (parser->status >= 0xF0)
+    {
+        // System common is not used, and does not set running status.
+        parser->status = 0;
+        return false;
     }
+    return channel_message(parser->status, parser->data, msg);
 }
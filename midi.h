@@ -1,24 +1,78 @@
+#pragma once
+
 #include <alsa/asoundlib.h>
 #include <stdbool.h>
 
+#define MIDI_MAX_PORTS (8)
+
 enum midi_msg_type
 {
     MIDI_MSG_NONE = 0,
     MIDI_MSG_NOTE_ON,
     MIDI_MSG_NOTE_OFF,
+    MIDI_MSG_POLY_AFTERTOUCH,
+    MIDI_MSG_CONTROL_CHANGE,
+    MIDI_MSG_PROGRAM_CHANGE,
+    MIDI_MSG_CHANNEL_AFTERTOUCH,
+    MIDI_MSG_PITCH_BEND,
+    MIDI_MSG_CLOCK,
+    MIDI_MSG_START,
+    MIDI_MSG_CONTINUE,
+    MIDI_MSG_STOP,
+    MIDI_MSG_ACTIVE_SENSING,
+    MIDI_MSG_RESET,
     MIDI_MSG_NBR_OFF,
 };
 struct midi_note
 {
     int key;
-    float velocity;
+    float velocity; // pressure for poly aftertouch
+};
+struct midi_control
+{
+    int number;
+    int value;
 };
 struct midi_message
 {
     enum midi_msg_type type;
-    struct midi_note note;
+    int channel;
+    union {
+        struct midi_note note;
+        struct midi_control control;
+        int program;
+        float pressure; // channel aftertouch, 0 to 1
+        float bend;     // -1 to 1
+    };
+};
+
+// Parser state, one per byte stream. Holds running status and the data bytes of the message being read.
+struct midi_parser
+{
+    unsigned char status;
+    unsigned char data[2];
+    int nbr_data;
+    bool in_sysex;
+};
+
+// Called from the MIDI thread with the time the kernel received the event, in CLOCK_MONOTONIC nanoseconds.
+typedef void (*midi_event_cb)(const struct midi_message *msg, long long ns, void *arg);
+// Polled from the MIDI thread for messages to send. Returns false when there are none, otherwise fills msg and the
+// CLOCK_MONOTONIC time it should go out at. Only clock and transport messages are sent.
+typedef bool (*midi_out_cb)(struct midi_message *msg, long long *ns, void *arg);
+
+struct midi_config
+{
+    const char *in_ports[MIDI_MAX_PORTS]; // "client:port"
+    int nbr_in_ports;
+    const char *out_ports[MIDI_MAX_PORTS];
+    int nbr_out_ports;
+    midi_event_cb event_cb;
+    midi_out_cb out_cb; // may be NULL
+    void *arg;
 };
 
-snd_rawmidi_t *midi_start();
-void midi_stop(snd_rawmidi_t *inputp);
-bool midi_get(snd_rawmidi_t *inputp, struct midi_message *msg);
+int midi_start(const struct midi_config *config);
+void midi_stop();
+void midi_parser_init(struct midi_parser *parser);
+bool midi_parse_byte(struct midi_parser *parser, unsigned char byte, struct midi_message *msg);
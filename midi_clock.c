@@ -0,0 +1,61 @@
+#include <math.h>
+
+#include "midi_clock.h"
+
+// Loop bandwidth relative to the tick rate. Low enough to average away the jitter of a USB or DIN link over a few
+// beats, high enough to follow a tempo change within a bar or two.
+#define BANDWIDTH (0.01)
+
+void midi_clock_init(struct midi_clock *mc)
+{
+    double omega = 2 * M_PI * BANDWIDTH;
+
+    mc->locked = false;
+    mc->nbr_ticks = 0;
+    mc->period = 0.0;
+    mc->next = 0.0;
+    mc->b = M_SQRT2 * omega;
+    mc->c = omega * omega;
+}
+
+// Feeds the time a tick was received at and returns the filtered time of that tick.
+long long midi_clock_tick(struct midi_clock *mc, long long ns)
+{
+    double t, e;
+
+    // A stopped or restarted master, start over.
+    if (mc->locked && fabs(ns - mc->next) > 4 * mc->period)
+    {
+        mc->locked = false;
+        mc->nbr_ticks = 0;
+    }
+
+    // The first two ticks give the starting period, until then next is the time of the last tick.
+    if (!mc->locked)
+    {
+        if (mc->nbr_ticks++ > 0 && ns > mc->next)
+        {
+            mc->period = ns - mc->next;
+            mc->locked = true;
+            mc->next = ns + mc->period;
+        }
+        else
+        {
+            mc->next = ns;
+        }
+        return ns;
+    }
+
+    e = ns - mc->next;
+    t = mc->next;
+    mc->next += mc->period + mc->b * e;
+    mc->period += mc->c * e;
+    return t;
+}
+
+double midi_clock_bpm(const struct midi_clock *mc)
+{
+    if (!mc->locked)
+        return 0.0;
+    return 60e9 / (mc->period * MIDI_CLOCKS_PER_BEAT);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+
+#define MIDI_CLOCKS_PER_BEAT (24)
+
+// Tracks an incoming MIDI clock with a second order delay locked loop. The tick times it hands back follow the
+// tempo of the master but not the jitter of the individual ticks.
+struct midi_clock
+{
+    bool locked;
+    int nbr_ticks;
+    double period; // filtered ns between ticks
+    double next;   // predicted time of the next tick
+    double b;
+    double c;
+};
+
+void midi_clock_init(struct midi_clock *mc);
+long long midi_clock_tick(struct midi_clock *mc, long long ns);
+double midi_clock_bpm(const struct midi_clock *mc);
@@ -0,0 +1,143 @@
+#include <libgen.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bank.h"
+
+// Builds a preset bank from settings files, one preset per file, named after the file.
+//
+//     mkbank out.bank bright.txt dark.txt ...
+
+#define MAX_PARAMS (256)
+#define LINE_LEN (256)
+
+struct preset
+{
+    char name[BANK_NAME_LEN];
+    float values[MAX_PARAMS];
+};
+
+static char labels[MAX_PARAMS][BANK_NAME_LEN];
+static int nbr_params = 0;
+static struct preset *presets;
+static int nbr_presets = 0;
+
+// Returns -1 if the table is full. The label is shorter than BANK_NAME_LEN.
+static int label_index(const char *label, size_t len)
+{
+    for (int i = 0; i < nbr_params; i++)
+    {
+        if (!strcmp(labels[i], label))
+            return i;
+    }
+    if (nbr_params == MAX_PARAMS)
+        return -1;
+    memcpy(labels[nbr_params], label, len + 1);
+    return nbr_params++;
+}
+
+static int read_preset(const char *filename, struct preset *preset)
+{
+    char line[LINE_LEN];
+    char path[LINE_LEN];
+    FILE *f = fopen(filename, "r");
+
+    if (!f)
+    {
+        fprintf(stderr, "%s: failed to open \"%s\"\n", __func__, filename);
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s", filename);
+    snprintf(preset->name, BANK_NAME_LEN, "%s", basename(path));
+    strtok(preset->name, ".");
+    for (int i = 0; i < MAX_PARAMS; i++)
+        preset->values[i] = NAN;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        char *sep = strstr(line, " = ");
+        int i;
+        if (!sep)
+            continue;
+        *sep = '\0';
+        if (sep - line >= BANK_NAME_LEN)
+        {
+            fprintf(stderr, "%s: label \"%s\" is too long, it is left out\n", __func__, line);
+            continue;
+        }
+        if ((i = label_index(line, sep - line)) < 0)
+        {
+            fprintf(stderr, "%s: too many parameters, \"%s\" is left out\n", __func__, line);
+            continue;
+        }
+        preset->values[i] = atof(sep + 3);
+    }
+    fclose(f);
+    return 0;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strncmp(presets[*(const uint32_t *)a].name, presets[*(const uint32_t *)b].name, BANK_NAME_LEN);
+}
+
+int main(int argc, char *argv[])
+{
+    struct bank_header header = {.version = BANK_VERSION};
+    uint32_t *by_name;
+    FILE *f;
+
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s out.bank settings...\n", argv[0]);
+        return 1;
+    }
+    presets = calloc(argc - 2, sizeof(*presets));
+    by_name = calloc(argc - 2, sizeof(*by_name));
+    if (!presets || !by_name)
+        return 2;
+    for (int i = 2; i < argc; i++)
+    {
+        if (read_preset(argv[i], &presets[nbr_presets]))
+            return 3;
+        by_name[nbr_presets] = nbr_presets;
+        nbr_presets++;
+    }
+    qsort(by_name, nbr_presets, sizeof(*by_name), compare_names);
+    for (int i = 1; i < nbr_presets; i++)
+    {
+        if (!compare_names(&by_name[i - 1], &by_name[i]))
+            fprintf(stderr, "Preset name \"%s\" is used twice, only one is found by name\n",
+                    presets[by_name[i]].name);
+    }
+
+    if (!(f = fopen(argv[1], "wb")))
+    {
+        perror("Failed to open bank!");
+        return 4;
+    }
+    memcpy(header.magic, BANK_MAGIC, sizeof(header.magic));
+    header.nbr_params = nbr_params;
+    header.nbr_presets = nbr_presets;
+    fwrite(&header, sizeof(header), 1, f);
+    for (int i = 0; i < nbr_params; i++)
+    {
+        param_id id = param_hash(labels[i]);
+        fwrite(&id, sizeof(id), 1, f);
+    }
+    fwrite(by_name, sizeof(*by_name), nbr_presets, f);
+    for (int i = 0; i < nbr_presets; i++)
+    {
+        fwrite(presets[i].name, BANK_NAME_LEN, 1, f);
+        fwrite(presets[i].values, sizeof(float), nbr_params, f);
+    }
+    if (fclose(f))
+    {
+        perror("Failed to write bank!");
+        return 4;
+    }
+    printf("%s: %d presets, %d parameters\n", argv[1], nbr_presets, nbr_params);
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mod.h"
+#include "util.h"
+
+static const char *source_names[MOD_SRC_COUNT] = {"env", "lfo", "velocity", "key", "cc"};
+
+// Called by the module that renders p, which makes p a destination. Returns the index the renderer looks it up by.
+int mod_add_dest(struct mod_matrix *m, struct ctrl_param *p)
+{
+    for (int i = 0; i < m->nbr_dests; i++)
+    {
+        if (m->dests[i] == p)
+            return i;
+    }
+    if (m->nbr_dests == MOD_MAX_DESTS)
+    {
+        fprintf(stderr, "%s: no room for \"%s\"\n", __func__, p->label);
+        return -1;
+    }
+    m->dests[m->nbr_dests] = p;
+    return m->nbr_dests++;
+}
+
+// Before the audio starts.
+int mod_add_route(struct mod_matrix *m, enum mod_source source, int cc, struct ctrl_param *dest, float amount,
+                  struct ctrl_param *amount_param)
+{
+    int d;
+
+    for (d = 0; d < m->nbr_dests && m->dests[d] != dest; d++)
+        ;
+    if (!dest || d == m->nbr_dests)
+    {
+        fprintf(stderr, "%s: \"%s\" can not be modulated\n", __func__, dest ? dest->label : "?");
+        return -1;
+    }
+    if (m->nbr_routes == MOD_MAX_ROUTES || cc < 0 || cc > 127)
+    {
+        fprintf(stderr, "%s: no room for a route to \"%s\"\n", __func__, dest->label);
+        return -1;
+    }
+    m->routes[m->nbr_routes++] = (struct mod_route){
+        .source = source, .cc = cc, .dest = d, .amount = amount, .amount_param = amount_param};
+    return 0;
+}
+
+// Adds a route from "source:LABEL:amount", where source is env, lfo, velocity, key or ccN.
+int mod_parse_route(struct mod_matrix *m, const char *spec)
+{
+    const char *first = strchr(spec, ':');
+    const char *last = strrchr(spec, ':');
+    char label[sizeof(((struct ctrl_param *)0)->label)];
+    size_t len;
+    int cc = 0;
+
+    if (!first || first == last || (size_t)(last - first - 1) >= sizeof(label))
+    {
+        fprintf(stderr, "%s: \"%s\" is not source:LABEL:amount\n", __func__, spec);
+        return -1;
+    }
+    len = last - first - 1;
+    memcpy(label, first + 1, len);
+    label[len] = '\0';
+
+    for (int s = 0; s < MOD_SRC_COUNT; s++)
+    {
+        size_t n = strlen(source_names[s]);
+        if (strncmp(spec, source_names[s], n))
+            continue;
+        if (s == MOD_SRC_CC)
+            cc = atoi(spec + n);
+        else if (spec + n != first)
+            continue;
+        return mod_add_route(m, s, cc, param_find(label), atof(last + 1), NULL);
+    }
+    fprintf(stderr, "%s: unknown source in \"%s\"\n", __func__, spec);
+    return -1;
+}
+
+// On the audio thread, as the controller is applied.
+void mod_set_cc(struct mod_matrix *m, int number, int value)
+{
+    if (number >= 0 && number < 128)
+        m->cc_values[number] = value / 127.0f;
+}
+
+// Called by the renderer at the start of every block. Picks the routes with an amount.
+void mod_block(struct mod_matrix *m)
+{
+    m->nbr_active = 0;
+    memset(m->routed, 0, sizeof(m->routed));
+    memset(m->uses, 0, sizeof(m->uses));
+    for (int i = 0; i < m->nbr_routes; i++)
+    {
+        struct mod_route r = m->routes[i];
+        if (r.amount_param)
+            r.amount = r.amount_param->block;
+        if (r.amount == 0.0f)
+            continue;
+        m->active[m->nbr_active++] = r;
+        m->routed[r.dest] = true;
+        m->uses[r.source] = true;
+    }
+}
+
+bool mod_uses(const struct mod_matrix *m, enum mod_source source)
+{
+    return m->uses[source];
+}
+
+bool mod_routed(const struct mod_matrix *m, int dest)
+{
+    return dest >= 0 && m->routed[dest];
+}
+
+// Sums the active routes into out, by destination. Destinations without a route are left alone.
+void mod_eval(const struct mod_matrix *m, const float *sources, float *out)
+{
+    for (int d = 0; d < m->nbr_dests; d++)
+    {
+        if (m->routed[d])
+            out[d] = 0.0f;
+    }
+    for (int i = 0; i < m->nbr_active; i++)
+    {
+        const struct mod_route *r = &m->active[i];
+        out[r->dest] += r->amount * (r->source == MOD_SRC_CC ? m->cc_values[r->cc] : sources[r->source]);
+    }
+}
+
+// The modulated value of a destination, kept in the range of its parameter.
+float mod_apply(const struct mod_matrix *m, int dest, float base, const float *out)
+{
+    const struct ctrl_param *p = m->dests[dest];
+    if (!m->routed[dest])
+        return base;
+    return min(p->max, max(p->min, base + out[dest]));
+}
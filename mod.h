@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "param.h"
+
+// Modulation matrix. Routes add a source, scaled by an amount, to a destination parameter, per voice. Only the routes
+// with a nonzero amount are evaluated, and the renderer only recomputes the destinations that have one.
+
+#define MOD_MAX_ROUTES (32)
+#define MOD_MAX_DESTS (8)
+#define MOD_INTERVAL (16) // frames between evaluations when a source moves within a block
+
+enum mod_source
+{
+    MOD_SRC_ENV = 0,  // envelope of the voice, 0 to 1
+    MOD_SRC_LFO,      // -1 to 1
+    MOD_SRC_VELOCITY, // 0 to 1
+    MOD_SRC_KEY,      // frequency of the note in Hz
+    MOD_SRC_CC,       // last value of a MIDI controller, 0 to 1
+    MOD_SRC_COUNT,
+};
+
+struct mod_route
+{
+    enum mod_source source;
+    int cc;   // controller number for MOD_SRC_CC
+    int dest; // index into dests
+    float amount;
+    struct ctrl_param *amount_param; // a slider for the amount, overrides amount when set
+};
+
+// The routes of one engine.
+struct mod_matrix
+{
+    struct ctrl_param *dests[MOD_MAX_DESTS];
+    int nbr_dests;
+    struct mod_route routes[MOD_MAX_ROUTES];
+    int nbr_routes;
+    float cc_values[128];
+
+    // RENDERER, the routes that count in this block
+    struct mod_route active[MOD_MAX_ROUTES];
+    int nbr_active;
+    bool routed[MOD_MAX_DESTS];
+    bool uses[MOD_SRC_COUNT];
+};
+
+int mod_add_dest(struct mod_matrix *m, struct ctrl_param *p);
+int mod_add_route(struct mod_matrix *m, enum mod_source source, int cc, struct ctrl_param *dest, float amount,
+                  struct ctrl_param *amount_param);
+int mod_parse_route(struct mod_matrix *m, const char *spec);
+void mod_set_cc(struct mod_matrix *m, int number, int value);
+
+void mod_block(struct mod_matrix *m);
+bool mod_uses(const struct mod_matrix *m, enum mod_source source);
+bool mod_routed(const struct mod_matrix *m, int dest);
+void mod_eval(const struct mod_matrix *m, const float *sources, float *out);
+float mod_apply(const struct mod_matrix *m, int dest, float base, const float *out);
@@ -1,8 +1,9 @@
 #pragma once
-#include <SDL3/SDL_audio.h>
-#include <SDL3/SDL_render.h>
+
+#include "linear_control.h"
 
 #define MAX_OSC_COUNT (4) // per voice
+#define OSC_MAX_GROUPS (3)
 
 enum osc_type
 {
@@ -17,13 +18,36 @@ struct osc_state
     float period_position[MAX_OSC_COUNT];
 };
 
-float osc_render_sample(long long current_frame, struct osc_state *state, const SDL_AudioSpec *spec, int key,
-                        enum osc_type type);
+// Shared by all the voices of an engine.
+struct osc_params
+{
+    struct ctrl_param base_width;
+    struct ctrl_param pwm_freq;
+    struct ctrl_param pwm_amount;
+    struct ctrl_param osc_cnt;
+    struct ctrl_param osc_detune_step;
+    struct ctrl_param_group pwm_ctrls;
+    struct ctrl_param_group detune_ctrls;
+    struct ctrl_param_group *groups[OSC_MAX_GROUPS];
+};
 
-void osc_init(struct osc_state *state, int x_in, int y_in);
+// The parameter values a block is rendered with, taken once at its start.
+struct osc_block
+{
+    float base_width;
+    float pwm_freq;
+    float pwm_amount;
+    float osc_cnt;
+    float osc_detune_step;
+};
 
-void osc_draw(SDL_Renderer *renderer);
+float osc_render_sample(long long current_frame, struct osc_state *state, const struct osc_block *block,
+                        int sample_rate, int key, enum osc_type type);
+float osc_render_pulse_sample(long long current_frame, struct osc_state *state, const struct osc_block *block,
+                              int sample_rate, int key);
+float osc_render_saw_sample(long long current_frame, struct osc_state *state, const struct osc_block *block,
+                            int sample_rate, int key);
 
-void osc_click(int x, int y);
-void osc_unclick();
-void osc_move(int x, int y);
+void osc_params_init(struct osc_params *params);
+void osc_snapshot(const struct osc_params *params, struct osc_block *block);
+void osc_init(struct osc_state *state);
@@ -0,0 +1,39 @@
+#include "osc_ui.h"
+#include "linear_control.h"
+#include "slide_controller.h"
+#include "text.h"
+#include "ui.h"
+
+// Sliders for the parameters of the engine that is shown.
+void osc_ui_init(struct osc_params *params, int x_in, int y_in)
+{
+    {
+#define WIDTH (1024)
+#define HEIGHT (768)
+        int i = 0;
+        int j = 0;
+        struct ctrl_param_group *pg;
+        struct ctrl_param *p;
+        const int margin = 10;
+        const int width = 100;
+        const int height = 10;
+        int label_height = text_get_height();
+        int tot_height = height + label_height;
+        int x = margin;
+        int y = margin;
+        while ((pg = params->groups[i++]))
+        {
+            j = 0;
+            while ((p = pg->params[j++]))
+            {
+                x = x_in + margin + (y + y_in) / (HEIGHT - tot_height) * (width + margin);
+                ui_add_slider(slide_controller_create(
+                                  x, (y + y_in) % (HEIGHT - tot_height), width, height,
+                                  (struct linear_control){&p->value, p->min, p->max, p->quantized_to_int}, p->label),
+                              UI_PANEL_OSC);
+                y += (margin + height + label_height);
+            }
+            y += 3 * margin;
+        }
+    }
+}
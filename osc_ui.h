@@ -0,0 +1,5 @@
+#pragma once
+
+#include "osc.h"
+
+void osc_ui_init(struct osc_params *params, int x, int y);
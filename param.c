@@ -0,0 +1,223 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "param.h"
+
+#define MAX_PARAMS (256)
+#define INDEX_LEN (1024) // power of two, kept at most a quarter full so probes stay short
+
+struct param_entry
+{
+    param_id id;
+    struct ctrl_param *p;
+    enum param_owner owner;
+};
+
+static struct param_entry params[MAX_PARAMS];
+static int nbr_params = 0;
+
+// Open addressing on the id, holds index + 1 so that zero is an empty slot.
+static unsigned short by_id[INDEX_LEN];
+
+static param_id hash_n(const char *label, size_t len)
+{
+    param_id h = 2166136261u;
+    while (len--)
+    {
+        h ^= (unsigned char)*label++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+param_id param_hash(const char *label)
+{
+    return hash_n(label, strlen(label));
+}
+
+static unsigned short *slot(param_id id)
+{
+    unsigned i = id & (INDEX_LEN - 1);
+    while (by_id[i] && params[by_id[i] - 1].id != id)
+        i = (i + 1) & (INDEX_LEN - 1);
+    return &by_id[i];
+}
+
+// Returns the index of the parameter, or -1 if the registry is full or the label is taken.
+int param_register(struct ctrl_param *p, enum param_owner owner)
+{
+    param_id id = param_hash(p->label);
+    unsigned short *s = slot(id);
+
+    if (*s)
+    {
+        if (params[*s - 1].p != p)
+            fprintf(stderr, "%s: \"%s\" clashes with \"%s\"\n", __func__, p->label, params[*s - 1].p->label);
+        return *s - 1;
+    }
+    if (nbr_params == MAX_PARAMS)
+    {
+        fprintf(stderr, "%s: no room for \"%s\"\n", __func__, p->label);
+        return -1;
+    }
+
+    params[nbr_params] = (struct param_entry){.id = id, .p = p, .owner = owner};
+    *s = ++nbr_params;
+    return nbr_params - 1;
+}
+
+void param_register_groups(struct ctrl_param_group **groups, enum param_owner owner)
+{
+    struct ctrl_param_group *pg;
+    int i = 0;
+
+    while ((pg = groups[i++]))
+    {
+        struct ctrl_param *p;
+        int j = 0;
+        while ((p = pg->params[j++]))
+            param_register(p, owner);
+    }
+}
+
+int param_count()
+{
+    return nbr_params;
+}
+
+struct ctrl_param *param_at(int index)
+{
+    return params[index].p;
+}
+
+param_id param_id_at(int index)
+{
+    return params[index].id;
+}
+
+enum param_owner param_owner_at(int index)
+{
+    return params[index].owner;
+}
+
+int param_index(param_id id)
+{
+    return *slot(id) - 1;
+}
+
+struct ctrl_param *param_get(param_id id)
+{
+    int i = param_index(id);
+    return i < 0 ? NULL : params[i].p;
+}
+
+struct ctrl_param *param_find(const char *label)
+{
+    struct ctrl_param *p = param_get(param_hash(label));
+    return p && !strcmp(p->label, label) ? p : NULL;
+}
+
+// Sets the value clamped to the range of the parameter, and rounded if it only takes whole numbers.
+bool param_set(struct ctrl_param *p, float value)
+{
+    if (!p)
+        return false;
+    if (value < p->min)
+        value = p->min;
+    if (value > p->max)
+        value = p->max;
+    if (p->quantized_to_int)
+        value = roundf(value);
+    p->value = value;
+    return true;
+}
+
+void param_save(FILE *f)
+{
+    for (int i = 0; i < nbr_params; i++)
+        fprintf(f, "%s = %f\n", params[i].p->label, params[i].p->value);
+}
+
+// Finds the parameter from a label that is not terminated, as it sits in a settings file.
+static struct ctrl_param *find_n(const char *label, size_t len)
+{
+    struct ctrl_param *p = param_get(hash_n(label, len));
+    return p && len < sizeof(p->label) && !strncmp(p->label, label, len) && p->label[len] == '\0' ? p : NULL;
+}
+
+// Sets the parameter on one "LABEL = value" line of len bytes, the line does not have to be terminated.
+static bool read_line(const char *line, size_t len, param_map_cb map, void *arg)
+{
+    struct ctrl_param *p;
+    char value[32];
+    const char *sep = memmem(line, len, " = ", 3);
+    size_t value_len;
+
+    if (!sep)
+        return false;
+    value_len = len - (sep + 3 - line);
+    if (value_len >= sizeof(value))
+        return false;
+    memcpy(value, sep + 3, value_len);
+    value[value_len] = '\0';
+    p = find_n(line, sep - line);
+    if (p && map)
+        p = map(p, arg);
+    return param_set(p, atof(value));
+}
+
+bool param_read_setting(const char *line)
+{
+    return read_line(line, strlen(line), NULL, NULL);
+}
+
+// Maps the settings file and reads it in one pass. Returns the number of parameters that were set, or -1 if the file
+// could not be read.
+int param_load(const char *filename)
+{
+    return param_load_mapped(filename, NULL, NULL);
+}
+
+// Same, but every parameter goes through map first.
+int param_load_mapped(const char *filename, param_map_cb map, void *arg)
+{
+    struct stat st;
+    const char *data, *p, *end;
+    int fd = open(filename, O_RDONLY);
+    int n = 0;
+
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st))
+    {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return -1;
+
+    end = data + st.st_size;
+    for (p = data; p < end;)
+    {
+        const char *eol = memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+        n += read_line(p, eol - p, map, arg);
+        p = eol + 1;
+    }
+    munmap((void *)data, st.st_size);
+    return n;
+}
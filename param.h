@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "linear_control.h"
+
+// Registry of every parameter in the synth. The ctrl_param objects stay with the module that owns them, the registry
+// gives each a stable id, the FNV-1a hash of its label, and finds them by id or label through a hash index.
+
+enum param_owner
+{
+    PARAM_OWNER_MAIN = 0,
+    PARAM_OWNER_OSC,
+    PARAM_OWNER_FM,
+    PARAM_OWNER_COUNT,
+};
+
+typedef uint32_t param_id;
+
+// Redirects a registered parameter to another one with the same label, like the same parameter of another engine.
+typedef struct ctrl_param *(*param_map_cb)(struct ctrl_param *p, void *arg);
+
+param_id param_hash(const char *label);
+int param_register(struct ctrl_param *p, enum param_owner owner);
+void param_register_groups(struct ctrl_param_group **groups, enum param_owner owner);
+
+int param_count();
+struct ctrl_param *param_at(int index);
+param_id param_id_at(int index);
+enum param_owner param_owner_at(int index);
+int param_index(param_id id);
+struct ctrl_param *param_get(param_id id);
+struct ctrl_param *param_find(const char *label);
+bool param_set(struct ctrl_param *p, float value);
+
+void param_save(FILE *f);
+bool param_read_setting(const char *line);
+int param_load(const char *filename);
+int param_load_mapped(const char *filename, param_map_cb map, void *arg);
@@ -0,0 +1,273 @@
+#include <errno.h>
+#include <semaphore.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag.h"
+#include "distortion.h"
+#include "param.h"
+#include "parts.h"
+#include "realtime.h"
+#include "rt_check.h"
+
+struct part
+{
+    struct engine engine;
+    int channel;
+    int key_lo;
+    int key_hi;
+    struct event_queue events; // routed by the audio thread, played by whoever renders the part
+    float *buf;                // the rendered block, interleaved
+
+    // WORKER, every part but the first has one
+    pthread_t thread;
+    bool started;
+    sem_t start;
+    sem_t done;
+    long long frame;
+    int frames;
+    engine_input_cb input;
+    void *arg;
+};
+
+static struct part parts[PARTS_MAX];
+static int nbr_parts = 0;
+static int nbr_channels = 0;
+static volatile bool stopping = false;
+
+struct engine *parts_add(int channel, int key_lo, int key_hi)
+{
+    struct part *part;
+
+    if (nbr_parts == PARTS_MAX)
+    {
+        fprintf(stderr, "%s: No room for more than %d parts\n", __func__, PARTS_MAX);
+        return NULL;
+    }
+    part = &parts[nbr_parts++];
+    engine_init(&part->engine);
+    part->channel = channel;
+    part->key_lo = key_lo;
+    part->key_hi = key_hi;
+    return &part->engine;
+}
+
+int parts_count()
+{
+    return nbr_parts;
+}
+
+struct engine *parts_engine(int part)
+{
+    return &parts[part].engine;
+}
+
+bool parts_listens(int part, int channel)
+{
+    return parts[part].channel == PART_OMNI || parts[part].channel == channel;
+}
+
+// The registry points into the first part. Every registered parameter is a field of struct engine, so the same
+// parameter of another part is at the same offset into it.
+static struct ctrl_param *part_param(struct ctrl_param *p, void *arg)
+{
+    ptrdiff_t offset = (char *)p - (char *)&parts[0].engine;
+
+    if (offset < 0 || offset >= (ptrdiff_t)sizeof(struct engine))
+        return NULL;
+    return (struct ctrl_param *)((char *)arg + offset);
+}
+
+// Reads a settings file into a part. Returns the number of parameters that were set, or -1.
+int parts_load_settings(int part, const char *filename)
+{
+    if (part == 0)
+        return param_load(filename);
+    return param_load_mapped(filename, part_param, &parts[part].engine);
+}
+
+int parts_open(int sample_rate, int channels, int max_frames)
+{
+    nbr_channels = channels;
+    for (int i = 0; i < nbr_parts; i++)
+    {
+        if (engine_open(&parts[i].engine, sample_rate, channels))
+            return -1;
+        if (i > 0 && !(parts[i].buf = malloc(max_frames * channels * sizeof(float))))
+        {
+            fprintf(stderr, "%s: Failed to allocate the buffer of part %d\n", __func__, i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void sem_wait_intr(sem_t *sem)
+{
+    while (sem_wait(sem) && errno == EINTR)
+        ;
+}
+
+// Applies the events routed to e that are due at frame and returns how many frames can be rendered before the next
+// one.
+static int apply_events(struct engine *e, struct event_queue *q, long long frame, int frames)
+{
+    struct synth_event ev;
+
+    while (event_queue_peek(q, &ev))
+    {
+        if (ev.frame > frame)
+            return min(ev.frame - frame, (long long)frames);
+
+        if (ev.type == SYNTH_EVENT_NOTE_ON)
+            engine_note_on(e, ev.key, ev.value, frame);
+        else if (ev.type == SYNTH_EVENT_NOTE_OFF)
+            engine_note_off(e, ev.key, frame);
+        else if (ev.type == SYNTH_EVENT_CONTROL)
+            engine_control(e, ev.key, ev.value, frame);
+        else if (ev.type == SYNTH_EVENT_CLOCK_STEP)
+            sequencer_clock_step(&e->seq, frame, ev.value);
+        else
+            sequencer_transport(&e->seq, ev.type);
+        event_queue_pop(q);
+    }
+    return frames;
+}
+
+static int part_input(struct engine *e, long long frame, int frames, void *arg)
+{
+    struct part *part = arg;
+
+    if (part->input)
+        frames = part->input(e, frame, frames, part->arg);
+    return apply_events(e, &part->events, frame, frames);
+}
+
+static void *worker(void *arg)
+{
+    struct part *part = arg;
+
+    realtime_thread_enter();
+    while (true)
+    {
+        sem_wait_intr(&part->start);
+        if (stopping)
+            break;
+        rt_check_enter();
+        engine_render(&part->engine, &part->frame, part->frames, part->buf, part_input, part);
+        rt_check_leave();
+        sem_post(&part->done);
+    }
+    return NULL;
+}
+
+// The workers run with attr, the same as the audio thread.
+int parts_start(const pthread_attr_t *attr)
+{
+    stopping = false;
+    for (int i = 1; i < nbr_parts; i++)
+    {
+        struct part *part = &parts[i];
+
+        sem_init(&part->start, 0, 0);
+        sem_init(&part->done, 0, 0);
+        if (pthread_create(&part->thread, attr, worker, part))
+        {
+            perror("Failed to create part worker!");
+            return -1;
+        }
+        part->started = true;
+    }
+    return 0;
+}
+
+void parts_stop()
+{
+    stopping = true;
+    for (int i = 1; i < nbr_parts; i++)
+    {
+        struct part *part = &parts[i];
+
+        if (!part->started)
+            continue;
+        sem_post(&part->start);
+        pthread_join(part->thread, NULL);
+        sem_destroy(&part->start);
+        sem_destroy(&part->done);
+        part->started = false;
+    }
+}
+
+void parts_close()
+{
+    for (int i = 0; i < nbr_parts; i++)
+    {
+        engine_close(&parts[i].engine);
+        free(parts[i].buf);
+        parts[i].buf = NULL;
+    }
+}
+
+static void push(struct part *part, const struct synth_event *ev)
+{
+    if (!event_queue_push(&part->events, ev))
+        diag_post(DIAG_EVENT_DROPPED, ev->type, part - parts);
+}
+
+// Hands ev to every part that plays it. Notes and controllers go by channel and key, the clock and transport drive
+// the sequencer of the first part.
+void parts_route(const struct synth_event *ev)
+{
+    if (ev->type > SYNTH_EVENT_CONTROL)
+    {
+        push(&parts[0], ev);
+        return;
+    }
+    for (int i = 0; i < nbr_parts; i++)
+    {
+        struct part *part = &parts[i];
+
+        if (!parts_listens(i, ev->channel))
+            continue;
+        if (ev->type != SYNTH_EVENT_CONTROL && (ev->key < part->key_lo || ev->key > part->key_hi))
+            continue;
+        push(part, ev);
+    }
+}
+
+// Renders frames of every part into buf, the first one with input before its own events. The parts are summed and
+// clipped like a single engine clips its output.
+void parts_render(long long *current_frame, int frames, float *buf, engine_input_cb input, void *arg)
+{
+    long long frame = *current_frame;
+    int i, s;
+
+    for (i = 1; i < nbr_parts; i++)
+    {
+        parts[i].frame = frame;
+        parts[i].frames = frames;
+        sem_post(&parts[i].start);
+    }
+
+    parts[0].input = input;
+    parts[0].arg = arg;
+    engine_render(&parts[0].engine, current_frame, frames, buf, part_input, &parts[0]);
+
+    if (nbr_parts == 1)
+        return;
+    // Waiting for the workers is the one wait the audio thread is meant to do, they run at its priority and only
+    // render.
+    rt_check_leave();
+    for (i = 1; i < nbr_parts; i++)
+        sem_wait_intr(&parts[i].done);
+    rt_check_enter();
+    for (s = 0; s < frames * nbr_channels; s++)
+    {
+        float sum = buf[s];
+        for (i = 1; i < nbr_parts; i++)
+            sum += parts[i].buf[s];
+        buf[s] = distort(sum, 0.999, 100.0);
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "engine.h"
+#include "event_queue.h"
+
+#define PARTS_MAX (8)
+#define PART_OMNI (-1) // listens to every channel
+
+// Multi-timbral parts. Every part is a complete engine with its own parameters and voices that plays the notes of
+// one MIDI channel, optionally only a range of keys. Each block the first part is rendered on the calling thread and
+// the others on a worker thread each, then they are mixed. The first part is the one the registry, the ui, the
+// journal and the bank work on.
+
+struct engine *parts_add(int channel, int key_lo, int key_hi);
+int parts_count();
+struct engine *parts_engine(int part);
+bool parts_listens(int part, int channel);
+int parts_load_settings(int part, const char *filename);
+
+int parts_open(int sample_rate, int channels, int max_frames);
+int parts_start(const pthread_attr_t *attr);
+void parts_stop();
+void parts_close();
+
+// Audio thread only.
+void parts_route(const struct synth_event *ev);
+void parts_render(long long *current_frame, int frames, float *buf, engine_input_cb input, void *arg);
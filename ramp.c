@@ -0,0 +1,83 @@
+#include <math.h>
+#include <stdio.h>
+
+#include "ramp.h"
+
+#define SETTLED (1e-4) // of the range of the parameter, where an exponential ramp snaps to its target
+
+void ramp_add(struct ramp_set *set, struct ramp *r, struct ctrl_param *p, float ms, enum ramp_shape shape)
+{
+    if (set->nbr_ramps == RAMP_MAX)
+    {
+        fprintf(stderr, "%s: no room for \"%s\"\n", __func__, p->label);
+        return;
+    }
+    // NAN, so the first block starts on whatever value the settings left rather than ramping to it.
+    *r = (struct ramp){.p = p, .ms = ms, .shape = shape, .target = NAN, .start = NAN, .value = NAN};
+    set->ramps[set->nbr_ramps++] = r;
+}
+
+// Advances one ramp by frames, returns false once it has reached the target.
+static bool advance(struct ramp *r, int frames, int sample_rate)
+{
+    float remaining = r->target - r->value;
+
+    if (r->shape == RAMP_LINEAR)
+    {
+        if (fabsf(remaining) <= fabsf(r->step * frames))
+        {
+            r->value = r->target;
+            return false;
+        }
+        r->value += r->step * frames;
+        return true;
+    }
+
+    // ln(100) time constants in ms
+    r->value += remaining * (1.0f - expf(-4.6f * frames * 1000.0f / (r->ms * sample_rate)));
+    if (fabsf(r->target - r->value) < SETTLED * (r->p->max - r->p->min))
+    {
+        r->value = r->target;
+        return false;
+    }
+    return true;
+}
+
+// Called by the renderer once the length of the block is known. Picks up new targets and moves only the ramps that
+// have not arrived, so a block where nothing changes costs one compare per ramp.
+void ramp_block(struct ramp_set *set, int frames, int sample_rate)
+{
+    int n = 0;
+
+    for (int i = 0; i < set->nbr_ramps; i++)
+    {
+        struct ramp *r = set->ramps[i];
+        float target = r->p->block;
+
+        r->start = r->value;
+        if (target == r->target)
+            continue;
+        r->target = target;
+        if (isnan(r->value) || r->ms <= 0.0f)
+        {
+            r->start = r->value = target;
+            continue;
+        }
+        r->step = (target - r->value) * 1000.0f / (r->ms * sample_rate);
+        if (!r->moving)
+        {
+            r->moving = true;
+            set->moving[set->nbr_moving++] = r;
+        }
+    }
+
+    for (int i = 0; i < set->nbr_moving; i++)
+    {
+        struct ramp *r = set->moving[i];
+        if (advance(r, frames, sample_rate))
+            set->moving[n++] = r;
+        else
+            r->moving = false;
+    }
+    set->nbr_moving = n;
+}
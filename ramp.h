@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "linear_control.h"
+
+#define RAMP_MAX (32)
+
+// Smooths a parameter for the renderer. The slider, a preset or a replay sets ctrl_param.value, which is only the
+// target; the renderer reads the ramp, which moves towards the target over ms, once per block.
+
+enum ramp_shape
+{
+    RAMP_LINEAR = 0, // reaches the target after exactly ms
+    RAMP_EXP,        // one pole, within 1% of the target after ms, for parameters heard on a log scale
+};
+
+struct ramp
+{
+    struct ctrl_param *p;
+    float ms;
+    enum ramp_shape shape;
+    float target;
+    float start; // value at the start of the block
+    float value; // value at the end of the block
+    float step;  // per frame, linear ramps only
+    bool moving;
+};
+
+// The ramps of one engine.
+struct ramp_set
+{
+    struct ramp *ramps[RAMP_MAX];
+    int nbr_ramps;
+    struct ramp *moving[RAMP_MAX];
+    int nbr_moving;
+};
+
+void ramp_add(struct ramp_set *set, struct ramp *r, struct ctrl_param *p, float ms, enum ramp_shape shape);
+void ramp_block(struct ramp_set *set, int frames, int sample_rate);
+
+// Value frame frames into a block of length frames.
+static inline float ramp_at(const struct ramp *r, int frame, int frames)
+{
+    return r->start + (r->value - r->start) * frame / frames;
+}
@@ -0,0 +1,152 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <malloc.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include "realtime.h"
+
+#define PREFAULT_STACK_SIZE (256 * 1024)
+
+static void prefault_stack()
+{
+    volatile unsigned char stack[PREFAULT_STACK_SIZE];
+    memset((unsigned char *)stack, 0, sizeof(stack));
+}
+
+void realtime_lock_memory()
+{
+    // Keep freed memory in the heap instead of handing it back to the kernel, otherwise the next allocation will
+    // page fault again.
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE))
+    {
+        fprintf(stderr, "%s: mlockall failed, memory is not locked: %s\n", __func__, strerror(errno));
+        return;
+    }
+    prefault_stack();
+}
+
+static int parse_cpus(const char *list, cpu_set_t *set)
+{
+    const char *p = list;
+    CPU_ZERO(set);
+    while (*p)
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p || first < 0 || first >= CPU_SETSIZE)
+            return -1;
+        p = end;
+        if (*p == '-')
+        {
+            p++;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last >= CPU_SETSIZE)
+                return -1;
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, set);
+        if (*p == ',')
+            p++;
+        else if (*p)
+            return -1;
+    }
+    return 0;
+}
+
+static void *probe_thread(void *arg)
+{
+    return arg;
+}
+
+static bool set_realtime_attrs(pthread_attr_t *attr, const struct realtime_config *config)
+{
+    struct sched_param param = {.sched_priority = config->priority};
+    cpu_set_t cpus;
+    pthread_t probe;
+    int ret;
+
+    pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(attr, config->round_robin ? SCHED_RR : SCHED_FIFO);
+    if ((ret = pthread_attr_setschedparam(attr, &param)))
+    {
+        fprintf(stderr, "%s: Bad priority %d: %s\n", __func__, config->priority, strerror(ret));
+        return false;
+    }
+
+    if (config->cpus)
+    {
+        if (parse_cpus(config->cpus, &cpus))
+        {
+            fprintf(stderr, "%s: Bad cpu list \"%s\"\n", __func__, config->cpus);
+            return false;
+        }
+        pthread_attr_setaffinity_np(attr, sizeof(cpus), &cpus);
+    }
+
+    // Thread creation is where missing privileges show up. A timer thread that fails to start is silently dropped,
+    // so find out now.
+    if ((ret = pthread_create(&probe, attr, probe_thread, NULL)))
+    {
+        fprintf(stderr, "%s: Can not create real-time threads, running with normal priority: %s\n", __func__,
+                strerror(ret));
+        return false;
+    }
+    pthread_join(probe, NULL);
+    return true;
+}
+
+// Threads created with the attributes will run with the configured policy, priority and affinity. Returns false
+// and leaves default attributes if that is not allowed for this process.
+bool realtime_thread_attr_init(pthread_attr_t *attr, const struct realtime_config *config)
+{
+    pthread_attr_init(attr);
+    if (!config->enabled)
+        return false;
+
+    if (!set_realtime_attrs(attr, config))
+    {
+        pthread_attr_destroy(attr);
+        pthread_attr_init(attr);
+        return false;
+    }
+    return true;
+}
+
+// Called first on every real-time thread, also on threads created by SDL or JACK. Those may call it on every
+// callback, the stack is only prefaulted the first time on each thread.
+void realtime_thread_enter()
+{
+    static __thread bool prefaulted = false;
+
+    realtime_denormals_off();
+    if (!prefaulted)
+    {
+        prefault_stack();
+        prefaulted = true;
+    }
+}
+
+// Flush denormals to zero on the calling thread. Decaying filters and release tails otherwise end up in the very
+// slow denormal range.
+void realtime_denormals_off()
+{
+#if defined(__SSE__)
+    _mm_setcsr(_mm_getcsr() | 0x8040); // FTZ | DAZ
+#elif defined(__aarch64__)
+    unsigned long fpcr;
+    __asm__ volatile("mrs %0, fpcr" : "=r"(fpcr));
+    __asm__ volatile("msr fpcr, %0" : : "r"(fpcr | (1ul << 24))); // FZ
+#endif
+}
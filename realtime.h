@@ -0,0 +1,17 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+
+struct realtime_config
+{
+    bool enabled;
+    int priority; // 1-99
+    bool round_robin;
+    const char *cpus; // cpu list like "2,3" or "2-3", NULL to not pin
+};
+
+void realtime_lock_memory();
+bool realtime_thread_attr_init(pthread_attr_t *attr, const struct realtime_config *config);
+void realtime_thread_enter();
+void realtime_denormals_off();
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+#include "journal.h"
+#include "param.h"
+#include "util.h"
+
+// Plays notes and moves parameters while rendering in odd sized chunks, like the audio timer does, and records a
+// journal of it. The journal is then replayed in chunks of another size and the output has to be the same, bit for
+// bit.
+
+#define TEST_SAMPLE_RATE (48000)
+#define TEST_CHANNELS (2)
+#define TEST_FRAMES (2 * TEST_SAMPLE_RATE)
+#define TEST_REPLAY_CHUNK (4096)
+#define TEST_JOURNAL "replay_test.journal"
+
+struct note
+{
+    long long on;
+    long long off;
+    int key;
+};
+
+static const struct note notes[] = {
+    {100, 20000, 40}, {7000, 30011, 47}, {24000, 60000, 52}, {50001, 90000, 35}, {61234, 70000, 59},
+};
+#define NBR_NOTES (sizeof(notes) / sizeof(notes[0]))
+
+static const int live_chunks[] = {37, 300, 1, 129, 1024, 256, 77, 2000, 5};
+#define NBR_LIVE_CHUNKS (sizeof(live_chunks) / sizeof(live_chunks[0]))
+
+static struct engine engine;
+static float live[TEST_FRAMES * TEST_CHANNELS];
+static float replayed[TEST_FRAMES * TEST_CHANNELS];
+
+static void tap(enum engine_input input, int key, float value, long long frame)
+{
+    static const enum journal_type types[] = {
+        [ENGINE_NOTE_ON] = JOURNAL_NOTE_ON, [ENGINE_NOTE_OFF] = JOURNAL_NOTE_OFF, [ENGINE_CONTROL] = JOURNAL_CONTROL};
+
+    if (input == ENGINE_BLOCK)
+        journal_block(frame, key);
+    else
+        journal_record(types[input], key, value, frame);
+}
+
+// Plays the notes due at frame and cuts the block at the next one.
+static int play_notes(struct engine *e, long long frame, int frames, void *arg)
+{
+    for (int i = 0; i < (int)NBR_NOTES; i++)
+    {
+        if (notes[i].on == frame)
+            engine_note_on(e, notes[i].key, 1.0, frame);
+        else if (notes[i].off == frame)
+            engine_note_off(e, notes[i].key, frame);
+        if (notes[i].on > frame)
+            frames = min((long long)frames, notes[i].on - frame);
+        if (notes[i].off > frame)
+            frames = min((long long)frames, notes[i].off - frame);
+    }
+    return frames;
+}
+
+static void replay_record(const struct journal_record *rec, long long frame)
+{
+    if (rec->type == JOURNAL_NOTE_ON)
+        engine_note_on(&engine, rec->key, rec->value, frame);
+    else if (rec->type == JOURNAL_NOTE_OFF)
+        engine_note_off(&engine, rec->key, frame);
+    else if (rec->type == JOURNAL_CONTROL)
+        engine_control(&engine, rec->key, rec->value, frame);
+}
+
+static int replay(struct engine *e, long long frame, int frames, void *arg)
+{
+    return journal_replay_advance(frame, frames, replay_record);
+}
+
+static int open_engine()
+{
+    engine_init(&engine);
+    // The envelope and the LFO both move the cutoff, so the modulation runs at control rate.
+    engine.p.env_to_cutoff.value = 2000.0;
+    engine.p.cutoff_lfo_amp.value = 1000.0;
+    engine.p.cutoff_lfo_freq.value = 3.0;
+    return engine_open(&engine, TEST_SAMPLE_RATE, TEST_CHANNELS);
+}
+
+// Renders with the parameters moved between chunks, as a slider on another thread would.
+static int record_live()
+{
+    long long frame = 0;
+    float *out = live;
+
+    if (open_engine() || journal_start(TEST_JOURNAL, TEST_SAMPLE_RATE, TEST_CHANNELS))
+        return -1;
+    engine.tap = tap;
+    for (int i = 0; frame < TEST_FRAMES; i++)
+    {
+        int n = min(live_chunks[i % NBR_LIVE_CHUNKS], (int)(TEST_FRAMES - frame));
+
+        engine.p.cutoff.value = 300.0 + (i * 137) % 4000;
+        engine.p.amplitude.value = 0.2 + 0.1 * (i % 5);
+        engine.p.delay_ms.value = 100.0 + (i * 31) % 400;
+        engine.p.osc_type.value = (i / 50) % OSC_TYPE_COUNT;
+        engine_render(&engine, &frame, n, out, play_notes, NULL);
+        out += n * TEST_CHANNELS;
+    }
+    journal_stop(frame);
+    engine.tap = NULL;
+    engine_close(&engine);
+    return 0;
+}
+
+static int replay_journal()
+{
+    long long frame = 0;
+    float *out = replayed;
+    int sample_rate, channels;
+
+    if (open_engine() || journal_replay_load(TEST_JOURNAL, &sample_rate, &channels))
+        return -1;
+    while (frame < TEST_FRAMES)
+    {
+        int n = journal_replay_chunk(frame, min(TEST_REPLAY_CHUNK, (int)(TEST_FRAMES - frame)));
+        engine_render(&engine, &frame, n, out, replay, NULL);
+        out += n * TEST_CHANNELS;
+    }
+    engine_close(&engine);
+    return 0;
+}
+
+int main()
+{
+    init_key_to_freq();
+    engine_init(&engine);
+    param_register_groups(engine.p.groups, PARAM_OWNER_MAIN);
+    param_register_groups(engine.fm.groups, PARAM_OWNER_FM);
+    param_register_groups(engine.osc.groups, PARAM_OWNER_OSC);
+
+    if (record_live() || replay_journal())
+        return 1;
+    remove(TEST_JOURNAL);
+
+    for (int i = 0; i < TEST_FRAMES * TEST_CHANNELS; i++)
+    {
+        if (memcmp(&live[i], &replayed[i], sizeof(float)))
+        {
+            fprintf(stderr, "Replay differs at frame %d, %f instead of %f\n", i / TEST_CHANNELS, replayed[i], live[i]);
+            return 1;
+        }
+    }
+    printf("Replayed %d frames bit-exact\n", TEST_FRAMES);
+    return 0;
+}
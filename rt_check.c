@@ -0,0 +1,323 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rt_check.h"
+
+// Wraps libc functions that have no business on the audio thread. The wrappers are found before libc since they
+// live in the executable, and forward to the real implementation after reporting.
+//
+// Set SYNTH_ONE_RT_CHECK=abort in the environment to abort on the first violation instead of logging it.
+
+#define MAX_REPORTED (128)
+#define MAX_BACKTRACE (32)
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static __thread int rt_depth = 0;
+static __thread bool reporting = false;
+static bool abort_on_violation = false;
+
+// Claimed with a compare and swap, the audio thread and the part workers report at the same time.
+static void *reported[MAX_REPORTED];
+
+static int (*real_pthread_mutex_lock)(pthread_mutex_t *mutex);
+static int (*real_pthread_cond_wait)(pthread_cond_t *cond, pthread_mutex_t *mutex);
+static int (*real_pthread_cond_timedwait)(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                                          const struct timespec *abstime);
+static int (*real_sem_wait)(sem_t *sem);
+static int (*real_sem_timedwait)(sem_t *sem, const struct timespec *abstime);
+static int (*real_vprintf)(const char *format, va_list ap);
+static int (*real_vfprintf)(FILE *stream, const char *format, va_list ap);
+static int (*real_puts)(const char *s);
+static int (*real_fputs)(const char *s, FILE *stream);
+static int (*real_putchar)(int c);
+static int (*real_fputc)(int c, FILE *stream);
+static size_t (*real_fwrite)(const void *ptr, size_t size, size_t nmemb, FILE *stream);
+static int (*real_fflush)(FILE *stream);
+static ssize_t (*real_write)(int fd, const void *buf, size_t count);
+static ssize_t (*real_read)(int fd, void *buf, size_t count);
+static int (*real_poll)(struct pollfd *fds, nfds_t nfds, int timeout);
+static int (*real_nanosleep)(const struct timespec *req, struct timespec *rem);
+static int (*real_usleep)(useconds_t usec);
+static void (*real_exit)(int status);
+
+static void *real(const char *name)
+{
+    void *sym = dlsym(RTLD_NEXT, name);
+    if (!sym)
+    {
+        fprintf(stderr, "%s: Can not find %s\n", __func__, name);
+        abort();
+    }
+    return sym;
+}
+
+__attribute__((constructor)) static void rt_check_init()
+{
+    const char *mode = getenv("SYNTH_ONE_RT_CHECK");
+
+    real_pthread_mutex_lock = real("pthread_mutex_lock");
+    real_pthread_cond_wait = real("pthread_cond_wait");
+    real_pthread_cond_timedwait = real("pthread_cond_timedwait");
+    real_sem_wait = real("sem_wait");
+    real_sem_timedwait = real("sem_timedwait");
+    real_vprintf = real("vprintf");
+    real_vfprintf = real("vfprintf");
+    real_puts = real("puts");
+    real_fputs = real("fputs");
+    real_putchar = real("putchar");
+    real_fputc = real("fputc");
+    real_fwrite = real("fwrite");
+    real_fflush = real("fflush");
+    real_write = real("write");
+    real_read = real("read");
+    real_poll = real("poll");
+    real_nanosleep = real("nanosleep");
+    real_usleep = real("usleep");
+    real_exit = real("exit");
+
+    abort_on_violation = mode && 0 == strcmp(mode, "abort");
+
+    // backtrace() loads libgcc on first use, get that over with outside of the audio thread.
+    void *frames[1];
+    backtrace(frames, 1);
+}
+
+static bool already_reported(void *caller)
+{
+    for (int i = 0; i < MAX_REPORTED; i++)
+    {
+        void *slot = __atomic_load_n(&reported[i], __ATOMIC_ACQUIRE);
+        if (!slot && __atomic_compare_exchange_n(&reported[i], &slot, caller, false, __ATOMIC_ACQ_REL,
+                                                 __ATOMIC_ACQUIRE))
+            return false;
+        // Another thread may just have claimed the slot, for the same caller.
+        if (slot == caller)
+            return true;
+    }
+    return false;
+}
+
+static void violation(const char *what, void *caller)
+{
+    void *frames[MAX_BACKTRACE];
+    int n;
+
+    if (rt_depth <= 0 || reporting)
+        return;
+
+    reporting = true;
+    if (abort_on_violation || !already_reported(caller))
+    {
+        char msg[128];
+        int len = snprintf(msg, sizeof(msg), "RT CHECK: %s called from the audio thread\n", what);
+        real_write(STDERR_FILENO, msg, len < (int)sizeof(msg) ? len : (int)sizeof(msg) - 1);
+        n = backtrace(frames, MAX_BACKTRACE);
+        backtrace_symbols_fd(frames, n, STDERR_FILENO);
+        if (abort_on_violation)
+            abort();
+    }
+    reporting = false;
+}
+
+#define CHECK(what) violation(what, __builtin_return_address(0))
+
+void rt_check_enter()
+{
+    rt_depth++;
+}
+
+void rt_check_leave()
+{
+    rt_depth--;
+}
+
+void *malloc(size_t size)
+{
+    CHECK("malloc");
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    CHECK("calloc");
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    CHECK("realloc");
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    CHECK("free");
+    __libc_free(ptr);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    CHECK("aligned_alloc");
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    CHECK("posix_memalign");
+    *memptr = __libc_memalign(alignment, size);
+    return *memptr ? 0 : ENOMEM;
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+    CHECK("pthread_mutex_lock");
+    return real_pthread_mutex_lock(mutex);
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+    CHECK("pthread_cond_wait");
+    return real_pthread_cond_wait(cond, mutex);
+}
+
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *abstime)
+{
+    CHECK("pthread_cond_timedwait");
+    return real_pthread_cond_timedwait(cond, mutex, abstime);
+}
+
+int sem_wait(sem_t *sem)
+{
+    CHECK("sem_wait");
+    return real_sem_wait(sem);
+}
+
+int sem_timedwait(sem_t *sem, const struct timespec *abstime)
+{
+    CHECK("sem_timedwait");
+    return real_sem_timedwait(sem, abstime);
+}
+
+int printf(const char *format, ...)
+{
+    va_list ap;
+    int ret;
+    CHECK("printf");
+    va_start(ap, format);
+    ret = real_vprintf(format, ap);
+    va_end(ap);
+    return ret;
+}
+
+int fprintf(FILE *stream, const char *format, ...)
+{
+    va_list ap;
+    int ret;
+    CHECK("fprintf");
+    va_start(ap, format);
+    ret = real_vfprintf(stream, format, ap);
+    va_end(ap);
+    return ret;
+}
+
+int vprintf(const char *format, va_list ap)
+{
+    CHECK("vprintf");
+    return real_vprintf(format, ap);
+}
+
+int vfprintf(FILE *stream, const char *format, va_list ap)
+{
+    CHECK("vfprintf");
+    return real_vfprintf(stream, format, ap);
+}
+
+int puts(const char *s)
+{
+    CHECK("puts");
+    return real_puts(s);
+}
+
+int fputs(const char *s, FILE *stream)
+{
+    CHECK("fputs");
+    return real_fputs(s, stream);
+}
+
+int putchar(int c)
+{
+    CHECK("putchar");
+    return real_putchar(c);
+}
+
+int fputc(int c, FILE *stream)
+{
+    CHECK("fputc");
+    return real_fputc(c, stream);
+}
+
+size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream)
+{
+    CHECK("fwrite");
+    return real_fwrite(ptr, size, nmemb, stream);
+}
+
+int fflush(FILE *stream)
+{
+    CHECK("fflush");
+    return real_fflush(stream);
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+    CHECK("write");
+    return real_write(fd, buf, count);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+    CHECK("read");
+    return real_read(fd, buf, count);
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    CHECK("poll");
+    return real_poll(fds, nfds, timeout);
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem)
+{
+    CHECK("nanosleep");
+    return real_nanosleep(req, rem);
+}
+
+int usleep(useconds_t usec)
+{
+    CHECK("usleep");
+    return real_usleep(usec);
+}
+
+void exit(int status)
+{
+    CHECK("exit");
+    real_exit(status);
+    __builtin_unreachable();
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+// Marks the calling thread as rendering audio. In builds with SYNTH_ONE_RT_CHECK any allocation, lock, stdio call
+// or blocking syscall made between enter and leave is reported with a backtrace.
+#ifdef SYNTH_ONE_RT_CHECK
+void rt_check_enter();
+void rt_check_leave();
+#else
+static inline void rt_check_enter()
+{
+}
+static inline void rt_check_leave()
+{
+}
+#endif
@@ -0,0 +1,52 @@
+#include <stdio.h>
+
+#include "engine.h"
+#include "rt_check.h"
+
+// Renders every oscillator type with notes and controllers played in between, all of it marked as the audio thread.
+// Run with SYNTH_ONE_RT_CHECK=abort, the first unsafe call fails the test.
+
+#define TEST_SAMPLE_RATE (48000)
+#define TEST_CHANNELS (2)
+#define TEST_BLOCKS (64)
+
+static struct engine engine;
+static float buf[ENGINE_BLOCK_FRAMES * TEST_CHANNELS];
+
+static void render_blocks(long long *frame)
+{
+    for (int i = 0; i < TEST_BLOCKS; i++)
+    {
+        if (i == 0)
+            engine_note_on(&engine, 40, 1.0, *frame);
+        else if (i == TEST_BLOCKS / 4)
+            engine_note_on(&engine, 47, 0.5, *frame);
+        else if (i == TEST_BLOCKS / 2)
+            engine_control(&engine, 1, 100, *frame);
+        else if (i == 3 * TEST_BLOCKS / 4)
+            engine_all_notes_off(&engine, *frame);
+        engine_render(&engine, frame, ENGINE_BLOCK_FRAMES, buf, NULL, NULL);
+    }
+}
+
+int main()
+{
+    long long frame = 0;
+
+    init_key_to_freq();
+    engine_init(&engine);
+    if (engine_open(&engine, TEST_SAMPLE_RATE, TEST_CHANNELS))
+        return 1;
+
+    rt_check_enter();
+    for (int type = 0; type < OSC_TYPE_COUNT; type++)
+    {
+        engine.p.osc_type.value = type;
+        render_blocks(&frame);
+    }
+    rt_check_leave();
+
+    engine_close(&engine);
+    printf("Rendered %lld frames\n", frame);
+    return 0;
+}
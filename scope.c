@@ -0,0 +1,53 @@
+#include <stdatomic.h>
+
+#include "scope.h"
+#include "util.h"
+
+#define RING_LEN (1 << 16) // power of two
+#define RING_MASK (RING_LEN - 1)
+
+static float ring[RING_LEN]; // indexed by frame number
+static atomic_llong end_frame = 0;
+static atomic_llong write_frame = 0; // the end of the block being written, published before it is written
+static atomic_int period = 1;
+
+void scope_write(long long start_frame, const float *samples, int n)
+{
+    atomic_store_explicit(&write_frame, start_frame + n, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (int i = 0; i < n; i++)
+        ring[(start_frame + i) & RING_MASK] = samples[i];
+    atomic_store_explicit(&end_frame, start_frame + n, memory_order_release);
+}
+
+void scope_set_period(int samples_per_period)
+{
+    atomic_store_explicit(&period, max(1, samples_per_period), memory_order_relaxed);
+}
+
+// Fills out with len points, starting at the latest period start and spread over one period when the period is
+// longer than len. Returns the number of points read, 0 if there was no complete window to read.
+int scope_read(float *out, int len)
+{
+    long long end = atomic_load_explicit(&end_frame, memory_order_acquire);
+    int spp = atomic_load_explicit(&period, memory_order_relaxed);
+    int step = max(1, spp / len);
+    long long span = (long long)(len - 1) * step + 1;
+    long long start;
+
+    if (end < span)
+        return 0;
+    start = (end - span) / spp * spp;
+
+    for (int i = 0; i < len; i++)
+        out[i] = ring[(start + (long long)i * step) & RING_MASK];
+
+    // The writer never waits for us, so throw the window away if it was overwritten while we copied it. That
+    // includes the block the writer may be in the middle of, not only the ones it has finished.
+    atomic_thread_fence(memory_order_acquire);
+    end = atomic_load_explicit(&write_frame, memory_order_relaxed);
+    if (end - RING_LEN > start)
+        return 0;
+
+    return len;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// Single producer ring the audio thread writes its output into. The UI thread picks a triggered and decimated
+// window out of it whenever it draws, without ever holding up the audio thread.
+
+void scope_write(long long start_frame, const float *samples, int n);
+void scope_set_period(int samples_per_period);
+int scope_read(float *out, int len);
@@ -1,152 +1,214 @@
-#include <pthread.h>
-#include <signal.h>
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
+#include <string.h>
 
-#include "text.h"
+#include "midi_clock.h"
+#include "sequencer.h"
+#include "util.h"
 
-#define NBR_STEPS (16)
+#define NBR_STEPS SEQUENCER_NBR_STEPS
+#define STEPS_PER_BEAT (4)
 
-#define MARGIN 2
+double sequencer_frames_per_step(float bpm, int sample_rate)
+{
+    return sample_rate * 60.0 / (bpm * STEPS_PER_BEAT);
+}
 
-struct step
+// Copies the steps and the cursor for the ui, like a seqlock. The version is odd while the copy is written.
+static void publish(struct sequencer *seq)
 {
-    int key;
-    SDL_FPoint points[5];
-};
+    unsigned version = atomic_load_explicit(&seq->version, memory_order_relaxed);
 
-static struct step steps[NBR_STEPS];
-static SDL_FPoint big_square[5];
+    atomic_store_explicit(&seq->version, version + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(seq->view.steps, seq->steps, sizeof(seq->steps));
+    seq->view.step_idx = seq->step_idx;
+    atomic_store_explicit(&seq->version, version + 2, memory_order_release);
+}
 
-void (*note_change_cb)(int on_key, int off_key);
+static void release(struct sequencer *seq, long long frame)
+{
+    if (seq->sounding_key)
+        seq->note_off_cb(seq->arg, seq->sounding_key, frame);
+    seq->sounding_key = 0;
+}
 
-static int step_idx = 0;
-static timer_t sequencer_timer;
-static bool edit = false;
-static bool run = false;
-static bool running = false;
-static float bpm = 120.0;
-static int steps_per_beat = 4;
+static void send_clock(struct sequencer *seq, enum synth_event_type type, long long frame)
+{
+    struct synth_event ev = {.frame = frame, .type = type};
 
-#define LABEL_LEN (3)
+    if (seq->clock_out)
+        event_queue_push(seq->clock_out, &ev);
+}
 
-void sequencer_draw(SDL_Renderer *renderer)
+static void step(struct sequencer *seq, long long frame)
 {
-    int i = 0;
-    for (i = 0; i < NBR_STEPS; i++)
-    {
-        struct step *step = &steps[i];
-        char label[LABEL_LEN];
-        snprintf(label, LABEL_LEN, "%u", steps[i].key);
-
-        text_draw(renderer, label, step->points[4].x + MARGIN, step->points[4].y + MARGIN, false);
-        if (step_idx == i)
-            SDL_SetRenderDrawColor(renderer, 250, 50, 0, 255);
-        else
-            SDL_SetRenderDrawColor(renderer, 0, 50, 150, 255);
-        SDL_RenderLines(renderer, step->points, 5);
-    }
-    if (edit)
+    struct step *step;
+
+    release(seq, frame);
+    seq->step_idx = (seq->step_idx + 1) % NBR_STEPS;
+    step = &seq->steps[seq->step_idx];
+    if (step->key)
     {
-        SDL_SetRenderDrawColor(renderer, 250, 50, 0, 255);
-        SDL_RenderLines(renderer, big_square, 5);
+        seq->note_on_cb(seq->arg, step->key, frame);
+        seq->sounding_key = step->key;
+        seq->gate_off_frame = frame + max(1ll, llround(step->gate * seq->step_frames));
     }
+    seq->next_step_frame += seq->step_frames;
+    if (seq->next_step_frame <= frame) // fell behind, skip ahead instead of playing the missed steps all at once
+        seq->next_step_frame = frame + seq->step_frames;
+    // Clock ticks restart from every step so they can never drift away from it.
+    seq->next_tick_frame = frame;
+    publish(seq);
 }
 
-static void step(union sigval)
+// Called by the renderer at the start of every block. Plays the steps, gate ends and clock ticks that fall on frame,
+// and returns how many frames can be rendered before the next one, at most frames.
+int sequencer_advance(struct sequencer *seq, long long frame, int frames, double frames_per_step)
 {
-    if (run)
+    long long until = frame + frames;
+
+    if (!seq->run)
     {
-        int off_key = steps[step_idx].key;
-        step_idx = (step_idx + 1) % NBR_STEPS;
-        int on_key = steps[step_idx].key;
-        note_change_cb(on_key, off_key);
+        if (seq->running)
+        {
+            release(seq, frame);
+            seq->running = false;
+            if (!seq->external)
+                send_clock(seq, SYNTH_EVENT_STOP, frame);
+        }
+        return frames;
     }
-    else if (running)
+
+    if (seq->external)
     {
-        int off_key = steps[step_idx].key;
-        int on_key = 0;
-        step_idx = (step_idx + 1) % NBR_STEPS;
-        running = false;
-        note_change_cb(on_key, off_key);
+        // Steps are played by sequencer_clock_step(), only the gates are timed here.
+        seq->running = true;
+        if (seq->sounding_key && seq->gate_off_frame <= frame)
+            release(seq, frame);
+        if (seq->sounding_key)
+            until = min(until, seq->gate_off_frame);
+        return until - frame;
     }
-}
-
-static int setup_timer()
-{
-    struct sigevent sevnt = {.sigev_notify = SIGEV_THREAD, .sigev_notify_function = step};
 
-    float steps_per_second = bpm / 60 * steps_per_beat;
-    struct itimerspec new_value = {.it_interval = {.tv_nsec = 1000000000 / steps_per_second}};
-    new_value.it_value = new_value.it_interval;
+    if (!seq->running)
+    {
+        seq->running = true;
+        seq->next_step_frame = frame;
+        seq->step_frames = frames_per_step;
+        send_clock(seq, SYNTH_EVENT_START, frame);
+    }
+    else if (frames_per_step != seq->step_frames)
+    {
+        // A tempo change takes effect right here, the rest of the current step, gate and tick are stretched to match.
+        double ratio = frames_per_step / seq->step_frames;
+        seq->next_step_frame = frame + (seq->next_step_frame - frame) * ratio;
+        seq->next_tick_frame = frame + (seq->next_tick_frame - frame) * ratio;
+        if (seq->sounding_key)
+            seq->gate_off_frame = frame + llround((seq->gate_off_frame - frame) * ratio);
+        seq->step_frames = frames_per_step;
+    }
 
-    int ret = timer_create(CLOCK_MONOTONIC, &sevnt, &sequencer_timer);
-    if (ret)
+    if (seq->sounding_key && seq->gate_off_frame <= frame)
+        release(seq, frame);
+    if (seq->next_step_frame <= frame)
+        step(seq, frame);
+    if (seq->next_tick_frame <= frame)
     {
-        perror("Failed to create sequencer timer!");
-        return -1;
+        send_clock(seq, SYNTH_EVENT_CLOCK, frame);
+        seq->next_tick_frame += seq->step_frames * STEPS_PER_BEAT / MIDI_CLOCKS_PER_BEAT;
     }
 
-    timer_settime(sequencer_timer, 0, &new_value, NULL);
+    until = min(until, (long long)ceil(seq->next_step_frame));
+    // The last tick of a step would land on the next step, which sends it instead.
+    if (ceil(seq->next_tick_frame) < ceil(seq->next_step_frame))
+        until = min(until, (long long)ceil(seq->next_tick_frame));
+    if (seq->sounding_key)
+        until = min(until, seq->gate_off_frame);
+    return until - frame;
+}
 
-    return 0;
+// Plays a step at frame on a tick from the external clock.
+void sequencer_clock_step(struct sequencer *seq, long long frame, double frames_per_step)
+{
+    if (!seq->external || !seq->run)
+        return;
+    seq->step_frames = frames_per_step;
+    step(seq, frame);
 }
 
-void sequencer_init(void (*callback)(int on_key, int off_key))
+// Start, continue and stop from the external clock. Start rewinds so that the first step plays on the next tick.
+void sequencer_transport(struct sequencer *seq, enum synth_event_type type)
 {
-    int i = 0;
-    int x = 650;
-    int y = 450;
-    const int width = MARGIN * 2 + 2 * text_get_width();
-    const int height = MARGIN * 2 + text_get_height();
-    const int spacing = 2;
+    if (!seq->external)
+        return;
+    if (type == SYNTH_EVENT_START)
+        seq->step_idx = NBR_STEPS - 1;
+    seq->run = type != SYNTH_EVENT_STOP;
+    publish(seq);
+}
 
-    note_change_cb = callback;
+void sequencer_set_external(struct sequencer *seq, bool on)
+{
+    seq->external = on;
+}
 
-    big_square[0].x = x - MARGIN;
-    big_square[0].y = y - MARGIN;
-    big_square[1].x = x + NBR_STEPS * (width + spacing);
-    big_square[1].y = y - MARGIN;
-    big_square[2].x = x + NBR_STEPS * (width + spacing);
-    big_square[2].y = y + height + MARGIN;
-    big_square[3].x = x - MARGIN;
-    big_square[3].y = y + height + MARGIN;
-    big_square[4].x = x - MARGIN;
-    big_square[4].y = y - MARGIN;
+void sequencer_set_clock_out(struct sequencer *seq, struct event_queue *q)
+{
+    seq->clock_out = q;
+}
+
+void sequencer_init(struct sequencer *seq, sequencer_note_cb note_on, sequencer_note_cb note_off, void *arg)
+{
+    memset(seq, 0, sizeof(*seq));
+    seq->note_on_cb = note_on;
+    seq->note_off_cb = note_off;
+    seq->arg = arg;
 
-    for (i = 0; i < NBR_STEPS; i++)
+    for (int i = 0; i < NBR_STEPS; i++)
     {
-        steps[i].key = 1 + ((i + 1) % 3 == 0) * 5 + ((i + 2) % 3 == 0) * 12;
-        steps[i].points[0].x = x;
-        steps[i].points[0].y = y;
-        steps[i].points[1].x = x + width;
-        steps[i].points[1].y = y;
-        steps[i].points[2].x = x + width;
-        steps[i].points[2].y = y + height;
-        steps[i].points[3].x = x;
-        steps[i].points[3].y = y + height;
-        steps[i].points[4].x = x;
-        steps[i].points[4].y = y;
-
-        x += width + spacing;
+        seq->steps[i].key = 1 + ((i + 1) % 3 == 0) * 5 + ((i + 2) % 3 == 0) * 12;
+        seq->steps[i].gate = 0.5;
     }
-    setup_timer();
+    publish(seq);
 }
 
-void sequencer_toggle_run()
+// Audio thread, from a SYNTH_EVENT_SEQ_RUN.
+void sequencer_toggle_run(struct sequencer *seq)
 {
-    run = !run;
+    seq->run = !seq->run;
 }
 
-void sequencer_toggle_edit()
+// Ui thread, the ui sends keys as SYNTH_EVENT_SEQ_INPUT instead of playing them while editing.
+void sequencer_toggle_edit(struct sequencer *seq)
 {
-    edit = !edit;
+    seq->edit = !seq->edit;
 }
 
-void sequencer_input(int key)
+// Audio thread, from a SYNTH_EVENT_SEQ_INPUT. Sets the step at the cursor and moves on to the next one.
+void sequencer_input(struct sequencer *seq, int key, float gate)
 {
-    if (edit)
-    {
-        steps[step_idx].key = key;
-        step_idx = (step_idx + 1) % NBR_STEPS;
-    }
+    seq->steps[seq->step_idx].key = key;
+    seq->steps[seq->step_idx].gate = gate;
+    seq->step_idx = (seq->step_idx + 1) % NBR_STEPS;
+    publish(seq);
+}
+
+// Changes whenever the view does.
+unsigned sequencer_version(struct sequencer *seq)
+{
+    return atomic_load_explicit(&seq->version, memory_order_acquire);
+}
+
+// From the ui thread. Returns false if the audio thread published a new view while it was copied.
+bool sequencer_read_view(struct sequencer *seq, struct sequencer_view *view)
+{
+    unsigned version = atomic_load_explicit(&seq->version, memory_order_acquire);
+
+    if (version & 1)
+        return false;
+    memcpy(view, &seq->view, sizeof(*view));
+    atomic_thread_fence(memory_order_acquire);
+    return version == atomic_load_explicit(&seq->version, memory_order_relaxed);
 }
@@ -1,7 +1,63 @@
 #pragma once
-#include <SDL3/SDL_render.h>
-void sequencer_init(void (*callback)(int on_key, int off_key));
-void sequencer_draw(SDL_Renderer *renderer);
-void sequencer_toggle_run();
-void sequencer_toggle_edit();
-void sequencer_input(int key);
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "event_queue.h"
+
+#define SEQUENCER_NBR_STEPS (16)
+
+typedef void (*sequencer_note_cb)(void *arg, int key, long long frame);
+
+struct step
+{
+    int key;
+    float gate; // part of the step the note is held, 0 to 1
+};
+
+// What the ui draws, a copy the audio thread publishes whenever it changes.
+struct sequencer_view
+{
+    struct step steps[SEQUENCER_NBR_STEPS];
+    int step_idx;
+};
+
+// Owned by the audio thread like the rest of the engine. The ui edits it through SYNTH_EVENT_SEQ_ events and draws
+// the published view.
+struct sequencer
+{
+    struct step steps[SEQUENCER_NBR_STEPS];
+    sequencer_note_cb note_on_cb;
+    sequencer_note_cb note_off_cb;
+    void *arg;
+
+    int step_idx;
+    bool run;
+    bool external; // steps come from MIDI clock instead of bpm
+    struct event_queue *clock_out;
+    bool edit; // ui thread only, keys are also written into the steps
+
+    struct sequencer_view view;
+    atomic_uint version; // odd while the view is written
+
+    // Playback state, only touched from the audio thread. Step starts are kept fractional so that rounding never
+    // accumulates into drift.
+    bool running;
+    double next_step_frame;
+    double step_frames;
+    double next_tick_frame;
+    long long gate_off_frame;
+    int sounding_key;
+};
+
+void sequencer_init(struct sequencer *seq, sequencer_note_cb note_on, sequencer_note_cb note_off, void *arg);
+double sequencer_frames_per_step(float bpm, int sample_rate);
+int sequencer_advance(struct sequencer *seq, long long frame, int frames, double frames_per_step);
+void sequencer_clock_step(struct sequencer *seq, long long frame, double frames_per_step);
+void sequencer_transport(struct sequencer *seq, enum synth_event_type type);
+void sequencer_set_external(struct sequencer *seq, bool on);
+void sequencer_set_clock_out(struct sequencer *seq, struct event_queue *q);
+void sequencer_toggle_run(struct sequencer *seq);
+void sequencer_toggle_edit(struct sequencer *seq);
+void sequencer_input(struct sequencer *seq, int key, float gate);
+unsigned sequencer_version(struct sequencer *seq);
+bool sequencer_read_view(struct sequencer *seq, struct sequencer_view *view);
@@ -0,0 +1,100 @@
+#include <stdio.h>
+
+#include "sequencer_ui.h"
+#include "text.h"
+#include "ui.h"
+
+#define NBR_STEPS SEQUENCER_NBR_STEPS
+
+#define MARGIN 2
+
+// Where the steps are drawn, the same for every sequencer.
+static SDL_FPoint step_points[NBR_STEPS][5];
+static SDL_FPoint big_square[5];
+
+// The sequencer that is drawn.
+static struct sequencer *shown = NULL;
+
+#define LABEL_LEN (3)
+
+// Edit mode is kept by the ui thread itself, it is not in the published view.
+static unsigned sequencer_state()
+{
+    return sequencer_version(shown) << 1 | shown->edit;
+}
+
+static void sequencer_draw(SDL_Renderer *renderer)
+{
+    struct sequencer_view view;
+    int i = 0;
+
+    // The audio thread publishes at most once a step, a copy that was torn is retried right away.
+    while (!sequencer_read_view(shown, &view))
+        ;
+    for (i = 0; i < NBR_STEPS; i++)
+    {
+        struct step *step = &view.steps[i];
+        SDL_FPoint *points = step_points[i];
+        char label[LABEL_LEN];
+        snprintf(label, LABEL_LEN, "%u", step->key);
+
+        text_draw(renderer, label, points[4].x + MARGIN, points[4].y + MARGIN, false);
+        if (view.step_idx == i)
+            SDL_SetRenderDrawColor(renderer, 250, 50, 0, 255);
+        else
+            SDL_SetRenderDrawColor(renderer, 0, 50, 150, 255);
+        SDL_RenderLines(renderer, points, 5);
+        SDL_RenderLine(renderer, points[3].x, points[3].y + MARGIN,
+                       points[3].x + step->gate * (points[2].x - points[3].x), points[3].y + MARGIN);
+    }
+    if (shown->edit)
+    {
+        SDL_SetRenderDrawColor(renderer, 250, 50, 0, 255);
+        SDL_RenderLines(renderer, big_square, 5);
+    }
+}
+
+// Draws seq in the main panel.
+void sequencer_ui_init(struct sequencer *seq)
+{
+    int i = 0;
+    int x = 650;
+    int y = 450;
+    const int width = MARGIN * 2 + 2 * text_get_width();
+    const int height = MARGIN * 2 + text_get_height();
+    const int spacing = 2;
+
+    shown = seq;
+
+    big_square[0].x = x - MARGIN;
+    big_square[0].y = y - MARGIN;
+    big_square[1].x = x + NBR_STEPS * (width + spacing);
+    big_square[1].y = y - MARGIN;
+    big_square[2].x = x + NBR_STEPS * (width + spacing);
+    big_square[2].y = y + height + MARGIN;
+    big_square[3].x = x - MARGIN;
+    big_square[3].y = y + height + MARGIN;
+    big_square[4].x = x - MARGIN;
+    big_square[4].y = y - MARGIN;
+
+    for (i = 0; i < NBR_STEPS; i++)
+    {
+        SDL_FPoint *points = step_points[i];
+        points[0].x = x;
+        points[0].y = y;
+        points[1].x = x + width;
+        points[1].y = y;
+        points[2].x = x + width;
+        points[2].y = y + height;
+        points[3].x = x;
+        points[3].y = y + height;
+        points[4].x = x;
+        points[4].y = y;
+
+        x += width + spacing;
+    }
+
+    ui_add_custom((SDL_FRect){big_square[0].x - 1, big_square[0].y - 1, big_square[2].x - big_square[0].x + 2,
+                              big_square[2].y - big_square[0].y + 2},
+                  UI_PANEL_MAIN, sequencer_draw, sequencer_state);
+}
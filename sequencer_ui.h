@@ -0,0 +1,5 @@
+#pragma once
+
+#include "sequencer.h"
+
+void sequencer_ui_init(struct sequencer *seq);
@@ -94,12 +94,7 @@ void slide_controller_unclick(struct slide_controller *sc)
 
 void slide_controller_draw(SDL_Renderer *renderer, struct slide_controller *sc)
 {
-
-    if (sc->width > sc->height)
-        text_draw(renderer, sc->label, sc->x, sc->y + sc->height, false);
-    else
-
-        text_draw(renderer, sc->label, sc->x + sc->width, sc->y + sc->height, true);
+    text_label_draw(renderer, sc->label_glyphs);
 
     SDL_SetRenderDrawColor(renderer, 0, 50, 150, 255);
     SDL_RenderLines(renderer, sc->border_points, 5);
@@ -121,6 +116,10 @@ struct slide_controller *slide_controller_create(int x, int y, int width, int he
     sc->control = control;
     sc->clicked = false;
     sc->label = label;
+    if (width > height)
+        sc->label_glyphs = text_label_create(label, x, y + height, false);
+    else
+        sc->label_glyphs = text_label_create(label, x + width, y + height, true);
 
     // calculate initial marker position
     slide_controller_set_pos_from_value(sc);
@@ -141,5 +140,6 @@ struct slide_controller *slide_controller_create(int x, int y, int width, int he
 
 void slide_controller_destroy(struct slide_controller *sc)
 {
+    text_label_destroy(sc->label_glyphs);
     free(sc);
 }
@@ -3,6 +3,7 @@
 #include <SDL3/SDL_render.h>
 
 #include "linear_control.h"
+#include "text.h"
 
 struct slide_controller
 {
@@ -12,6 +13,7 @@ struct slide_controller
     int width;
     int height;
     const char *label;
+    struct text_label *label_glyphs;
     struct linear_control control;
     SDL_FPoint marker_points[5];
     SDL_FPoint border_points[5];
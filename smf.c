@@ -0,0 +1,301 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "smf.h"
+#include "util.h"
+
+#define DEFAULT_TEMPO_US (500000) // 120 bpm until the file says otherwise
+
+struct smf_event
+{
+    long long tick;
+    int order;       // position in the file, keeps events on the same tick in file order
+    int tempo;       // microseconds per quarter note for tempo events, 0 otherwise
+    long long frame; // from the start of the song
+    struct midi_message msg;
+};
+
+struct reader
+{
+    const unsigned char *p;
+    const unsigned char *end;
+};
+
+static struct smf_event *events = NULL;
+static int nbr_events = 0;
+static int max_events = 0;
+
+// Playback state, only touched from the audio thread once started.
+static volatile bool start_pending = false;
+static bool playing = false;
+static long long start_frame;
+static int next_event;
+
+static bool read_bytes(struct reader *r, int n, unsigned long *value)
+{
+    if (r->end - r->p < n)
+        return false;
+    *value = 0;
+    while (n--)
+        *value = *value << 8 | *r->p++;
+    return true;
+}
+
+static bool read_var(struct reader *r, unsigned long *value)
+{
+    *value = 0;
+    for (int i = 0; i < 4 && r->p < r->end; i++)
+    {
+        unsigned char byte = *r->p++;
+        *value = *value << 7 | (byte & 0x7F);
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static struct smf_event *add_event(long long tick)
+{
+    struct smf_event *ev;
+
+    if (nbr_events == max_events)
+    {
+        int n = max(1024, 2 * max_events);
+        struct smf_event *new_events = realloc(events, n * sizeof(*events));
+        if (!new_events)
+            return NULL;
+        events = new_events;
+        max_events = n;
+    }
+    ev = &events[nbr_events];
+    memset(ev, 0, sizeof(*ev));
+    ev->tick = tick;
+    ev->order = nbr_events++;
+    return ev;
+}
+
+static bool read_track(struct reader *r)
+{
+    struct midi_parser parser;
+    long long tick = 0;
+
+    midi_parser_init(&parser);
+    while (r->p < r->end)
+    {
+        unsigned long delta, len;
+        unsigned char byte;
+
+        if (!read_var(r, &delta) || r->p == r->end)
+            return false;
+        tick += delta;
+        byte = *r->p;
+
+        if (byte == 0xFF) // META
+        {
+            unsigned long type, tempo;
+            r->p++;
+            if (!read_bytes(r, 1, &type) || !read_var(r, &len) || (unsigned long)(r->end - r->p) < len)
+                return false;
+            if (type == 0x2F) // end of track
+                return true;
+            if (type == 0x51 && len == 3)
+            {
+                struct smf_event *ev;
+                read_bytes(r, 3, &tempo);
+                if (!(ev = add_event(tick)))
+                    return false;
+                ev->tempo = tempo;
+            }
+            else
+            {
+                r->p += len;
+            }
+        }
+        else if (byte == 0xF0 || byte == 0xF7) // SYSEX, ends running status
+        {
+            struct midi_message msg;
+            r->p++;
+            if (!read_var(r, &len) || (unsigned long)(r->end - r->p) < len)
+                return false;
+            r->p += len;
+            midi_parse_byte(&parser, 0xF7, &msg);
+        }
+        else // CHANNEL MESSAGE, the status byte may be left out for running status
+        {
+            struct midi_message msg;
+            bool done = false;
+            if (!(byte & 0x80) && parser.status == 0)
+                return false;
+            if (byte & 0x80)
+                midi_parse_byte(&parser, *r->p++, &msg);
+            for (int i = 0; i < 2 && !done; i++)
+            {
+                if (r->p == r->end || *r->p & 0x80)
+                    return false;
+                done = midi_parse_byte(&parser, *r->p++, &msg);
+            }
+            if (done)
+            {
+                struct smf_event *ev = add_event(tick);
+                if (!ev)
+                    return false;
+                ev->msg = msg;
+            }
+        }
+    }
+    return true;
+}
+
+static int compare_events(const void *a, const void *b)
+{
+    const struct smf_event *ea = a;
+    const struct smf_event *eb = b;
+
+    if (ea->tick != eb->tick)
+        return ea->tick < eb->tick ? -1 : 1;
+    return ea->order - eb->order;
+}
+
+// Turns ticks into frames by walking the tempo map. The tempo events themselves are dropped on the way.
+static void resolve_frames(int division, int sample_rate)
+{
+    double seconds = 0.0;
+    long long last_tick = 0;
+    int tempo = DEFAULT_TEMPO_US;
+    int n = 0;
+
+    for (int i = 0; i < nbr_events; i++)
+    {
+        struct smf_event *ev = &events[i];
+
+        if (division & 0x8000) // SMPTE, frames per second and ticks per frame
+        {
+            int fps = -(signed char)(division >> 8);
+            double ticks_per_second = (fps == 29 ? 29.97 : fps) * (division & 0xFF);
+            seconds = ev->tick / ticks_per_second;
+        }
+        else
+        {
+            seconds += (double)(ev->tick - last_tick) * tempo / 1e6 / division;
+            last_tick = ev->tick;
+        }
+
+        if (ev->tempo)
+        {
+            tempo = ev->tempo;
+            continue;
+        }
+        ev->frame = llround(seconds * sample_rate);
+        events[n++] = *ev;
+    }
+    nbr_events = n;
+}
+
+// Loads a type 0 or 1 file, all tracks merged into one list of events timed in frames.
+int smf_load(const char *filename, int sample_rate)
+{
+    FILE *f = fopen(filename, "rb");
+    unsigned char *data;
+    long size;
+    struct reader r;
+    unsigned long id, len, format, nbr_tracks, division;
+
+    if (!f)
+    {
+        fprintf(stderr, "%s: failed to open \"%s\"\n", __func__, filename);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data = malloc(size);
+    if (!data || fread(data, 1, size, f) != (size_t)size)
+    {
+        fprintf(stderr, "%s: failed to read \"%s\"\n", __func__, filename);
+        free(data);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    smf_free();
+    r.p = data;
+    r.end = data + size;
+    if (!read_bytes(&r, 4, &id) || id != 0x4D546864 || !read_bytes(&r, 4, &len) || len < 6 ||
+        !read_bytes(&r, 2, &format) || !read_bytes(&r, 2, &nbr_tracks) || !read_bytes(&r, 2, &division) ||
+        format > 1 || division == 0)
+    {
+        fprintf(stderr, "%s: \"%s\" is not a type 0 or 1 MIDI file\n", __func__, filename);
+        free(data);
+        return -1;
+    }
+    r.p += len - 6;
+
+    for (unsigned long t = 0; t < nbr_tracks && r.p < r.end;)
+    {
+        struct reader track;
+        if (!read_bytes(&r, 4, &id) || !read_bytes(&r, 4, &len) || (unsigned long)(r.end - r.p) < len)
+            break;
+        track.p = r.p;
+        track.end = r.p + len;
+        r.p += len;
+        if (id != 0x4D54726B) // skip unknown chunks
+            continue;
+        if (!read_track(&track))
+            fprintf(stderr, "%s: track %lu of \"%s\" is damaged, using what could be read\n", __func__, t, filename);
+        t++;
+    }
+    free(data);
+
+    qsort(events, nbr_events, sizeof(*events), compare_events);
+    resolve_frames(division, sample_rate);
+    printf("%s: %d events, %.1f s\n", filename, nbr_events, 1.0 * smf_length() / sample_rate);
+    return 0;
+}
+
+void smf_free()
+{
+    free(events);
+    events = NULL;
+    nbr_events = 0;
+    max_events = 0;
+    playing = false;
+}
+
+// Playback starts on the next block the renderer asks for.
+void smf_start()
+{
+    start_pending = true;
+}
+
+long long smf_length()
+{
+    return nbr_events ? events[nbr_events - 1].frame : 0;
+}
+
+// Called by the renderer at the start of every block. Plays the events due at frame and returns how many frames can
+// be rendered before the next one, at most frames.
+int smf_advance(long long frame, int frames, smf_play_cb cb)
+{
+    if (start_pending)
+    {
+        start_pending = false;
+        playing = true;
+        start_frame = frame;
+        next_event = 0;
+    }
+    if (!playing)
+        return frames;
+
+    for (; next_event < nbr_events; next_event++)
+    {
+        long long at = start_frame + events[next_event].frame;
+        if (at > frame)
+            return min((long long)frames, at - frame);
+        cb(&events[next_event].msg, frame);
+    }
+    playing = false;
+    return frames;
+}
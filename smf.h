@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "midi.h"
+
+typedef void (*smf_play_cb)(const struct midi_message *msg, long long frame);
+
+int smf_load(const char *filename, int sample_rate);
+void smf_free();
+void smf_start();
+long long smf_length();
+int smf_advance(long long frame, int frames, smf_play_cb cb);
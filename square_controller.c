@@ -55,8 +55,8 @@ void square_controller_unclick(struct square_controller *sc)
 
 void square_controller_draw(SDL_Renderer *renderer, struct square_controller *sc)
 {
-    text_draw(renderer, sc->x_label, sc->x, sc->y + sc->height, false);
-    text_draw(renderer, sc->y_label, sc->x + sc->width, sc->y + sc->height, true);
+    text_label_draw(renderer, sc->x_label_glyphs);
+    text_label_draw(renderer, sc->y_label_glyphs);
 
     SDL_SetRenderDrawColor(renderer, 0, 50, 150, 255);
     SDL_RenderLines(renderer, sc->border_points, 5);
@@ -81,6 +81,8 @@ struct square_controller *square_controller_create(int x, int y, int width, int
     sc->clicked = false;
     sc->x_label = x_label;
     sc->y_label = y_label;
+    sc->x_label_glyphs = text_label_create(x_label, x, y + height, false);
+    sc->y_label_glyphs = text_label_create(y_label, x + width, y + height, true);
 
     // calculate initial marker position
     mx = round(((*x_control.target - x_control.min) / (x_control.max - x_control.min)) * width + x);
@@ -105,5 +107,7 @@ struct square_controller *square_controller_create(int x, int y, int width, int
 
 void square_controller_destroy(struct square_controller *sc)
 {
+    text_label_destroy(sc->x_label_glyphs);
+    text_label_destroy(sc->y_label_glyphs);
     free(sc);
 }
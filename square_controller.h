@@ -1,5 +1,6 @@
 #pragma once
 #include "linear_control.h"
+#include "text.h"
 #include <SDL3/SDL_render.h>
 
 struct square_controller
@@ -11,6 +12,8 @@ struct square_controller
     int height;
     const char *x_label;
     const char *y_label;
+    struct text_label *x_label_glyphs;
+    struct text_label *y_label_glyphs;
     struct linear_control x_control;
     struct linear_control y_control;
     SDL_FPoint marker_points[5];
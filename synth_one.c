@@ -5,248 +5,85 @@
 #include <malloc.h>
 #include <math.h>
 #include <pthread.h>
+#include <poll.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/timerfd.h>
 #include <time.h>
 #include <unistd.h>
 
-#include "cosine.h"
-#include "delay.h"
-#include "distortion.h"
-#include "envelope.h"
-#include "fm.h"
-#include "low_pass_filter.h"
+#include "alsa_pcm.h"
+#include "bank.h"
+#include "diag.h"
+#include "engine.h"
+#include "event_queue.h"
+#include "fm_ui.h"
+#include "frame_clock.h"
+#ifdef SYNTH_ONE_JACK
+#include "jack_io.h"
+#endif
+#include "journal.h"
 #include "midi.h"
-#include "osc.h"
-#include "sequencer.h"
+#include "midi_clock.h"
+#include "osc_ui.h"
+#include "param.h"
+#include "parts.h"
+#include "realtime.h"
+#include "rt_check.h"
+#include "scope.h"
+#include "sequencer_ui.h"
 #include "slide_controller.h"
-#include "square_controller.h"
+#include "smf.h"
 #include "text.h"
+#include "ui.h"
 #include "util.h"
+#include "wav.h"
 
 #define WIDTH (1024)
 #define HEIGHT (768)
 #define X_STEP (1)
 #define WAVEFORM_LEN (WIDTH / X_STEP)
 
-#define MAX_DELAY_MS (750)
-
-#define LINE_LEN (100)
-
-#define MAX_GROUPS (9)
-
 #define DEFAULT_SETTINGS_FILE_NAME "saved_settings.txt"
 
 #define NBR_BALLS (20)
 
-static bool synth_abort = false;
-
-static void pr_sdl_err()
-{
-    fprintf(stderr, "%s", SDL_GetError());
-    SDL_ClearError();
-}
-
-struct voice
-{
-    int key; // 0 is off, 1 is a C
-    long long released;
-    long long pressed;
-    struct env_state env;
-    struct filter_state filter;
-    struct osc_state osc;
-};
-
-struct voice voices[NBR_VOICES] = {};
-
-static struct ctrl_param op_amp = {
-    .label = "OP1 AMP",
-    .value = 0.01,
-    .min = 0.001,
-    .max = 0.1,
-};
-
-static struct ctrl_param op_freq = {
-    .label = "OP1 FREQ",
-    .value = 0.01,
-    .min = 0.001,
-    .max = 2.0,
-};
-
-static struct ctrl_param amplitude = {
-    .label = "LINEAR GAIN",
-    .value = 0.7,
-    .min = 0.1,
-    .max = 3,
-};
-
-static struct ctrl_param octave = {
-    .label = "OCTAVE",
-    .value = 0,
-    .min = 0,
-    .max = 5,
-    .quantized_to_int = true,
-};
-
-static struct ctrl_param osc_type = {
-    .label = "PULSE/SAW/FM",
-    .value = OSC_TYPE_PULSE,
-    .min = 0,
-    .max = OSC_TYPE_COUNT - 1,
-    .quantized_to_int = true,
-};
-
-static struct ctrl_param cutoff = {
-    .label = "CUTOFF",
-    .value = 17000,
-    .min = 50,
-    .max = 17000,
-};
-static struct ctrl_param resonance = {
-    .label = "RESONANCE",
-    .value = 0.0,
-    .min = 0.0,
-    .max = 0.98,
-};
-static struct ctrl_param key_to_cutoff = {
-    .label = "KEY TO CUTOFF",
-    .value = 0.0,
-    .min = 0.0,
-    .max = 1.0,
-};
-
-static struct ctrl_param cutoff_lfo_freq = {
-    .label = "CUTOFF LFO FREQ",
-    .value = 0.0,
-    .min = 0.0,
-    .max = 5.0,
-};
-
-static struct ctrl_param cutoff_lfo_amp = {
-    .label = "CUTOFF LFO AMP",
-    .value = 0.0,
-    .min = 0.0,
-    .max = 5000.0,
-};
-
-static struct ctrl_param bend_target = {
-    .label = "BEND",
-    .value = 1.0,
-    .min = -2.0,
-    .max = 2.0,
-};
-static float bend = 1.0;
-
-static struct ctrl_param dist_level = {
-    .label = "DIST THRESHOLD",
-    .value = 1.0,
-    .min = 0.01,
-    .max = 1.0,
-};
-static struct ctrl_param flip_level = {
-    .label = "FLIP THRESHOLD",
-    .value = 1.1,
-    .min = 0.01,
-    .max = 1.1,
-};
-
-static struct ctrl_param A = {
-    .label = "A",
-    .value = 0.1,
-    .min = 0.1,
-    .max = 500.0,
-};
-static struct ctrl_param D = {
-    .label = "D",
-    .value = 25,
-    .min = 0.1,
-    .max = 500,
-};
-static struct ctrl_param S = {
-    .label = "S",
-    .value = 1,
-    .min = 0,
-    .max = 1,
-};
-static struct ctrl_param R = {
-    .label = "R",
-    .value = 0,
-    .min = 0,
-    .max = 1000,
-};
-
-static struct ctrl_param env_to_cutoff = {
-    .label = "ENV TO CUTOFF",
-    .value = 0,
-    .min = 0,
-    .max = 10000,
-};
-static struct ctrl_param env_to_amp = {
-    .label = "ENV TO AMP",
-    .value = 1.0,
-    .min = 0,
-    .max = 1.0,
-    .quantized_to_int = true,
-};
-
-static struct ctrl_param delay_ms = {
-    .label = "DELAY [MS]",
-    .value = 600,
-    .min = 0,
-    .max = 1000,
-};
-
-static struct ctrl_param delay_fb = {
-    .label = "DELAY FEEDBACK",
-    .value = 0.0,
-    .min = 0.0,
-    .max = 0.9,
-};
+#define DEFAULT_RT_PRIORITY (70)
 
-static struct ctrl_param chorus_amount = {
-    .label = "CHORUS AMOUNT",
-    .value = 0.0,
-    .min = 0.0,
-    .max = 1.0,
-};
-
-static struct ctrl_param chorus_freq = {
-    .label = "CHORUS FREQ",
-    .value = 1.0,
-    .min = 0.1,
-    .max = 5.0,
-};
-
-static struct ctrl_param_group tone_ctrls = {
-    .params = {&amplitude, &osc_type, &octave, &env_to_amp, NULL},
-};
+#define DEFAULT_ALSA_DEVICE "plughw:0,0"
+#define DEFAULT_ALSA_RATE (48000)
+#define DEFAULT_ALSA_PERIOD_FRAMES (256)
 
-static struct ctrl_param_group envelope_ctrls = {
-    .params = {&A, &D, &S, &R, NULL},
-};
+#define OFFLINE_BUFFER_FRAMES (4096)
+#define OFFLINE_TAIL_SECONDS (2)
 
-static struct ctrl_param_group filter_ctrls = {
-    .params = {&cutoff, &resonance, &env_to_cutoff, &key_to_cutoff, &cutoff_lfo_freq, &cutoff_lfo_amp, NULL},
-};
+#define REDRAW_INTERVAL_NS (100000000ull / 8)
+#define REDRAW_POLL_TIMEOUT_MS (100)
 
-static struct ctrl_param_group dist_ctrls = {
-    .params = {&dist_level, &flip_level, NULL},
+enum user_event_code
+{
+    USER_EVENT_REDRAW = 1,
 };
 
-static struct ctrl_param_group delay_ctrls = {
-    .params = {&delay_fb, &delay_ms, NULL},
+enum audio_backend
+{
+    AUDIO_SDL = 0,
+    AUDIO_JACK,
+    AUDIO_ALSA,
 };
 
-static struct ctrl_param_group chorus_ctrls = {
-    .params = {&chorus_amount, &chorus_freq, NULL},
-};
+static volatile bool synth_abort = false;
 
-struct ctrl_param_group *param_groups[MAX_GROUPS] = {&tone_ctrls,  &envelope_ctrls, &filter_ctrls, &dist_ctrls,
-                                                     &delay_ctrls, &chorus_ctrls,   NULL};
+static void pr_sdl_err()
+{
+    fprintf(stderr, "%s", SDL_GetError());
+    SDL_ClearError();
+}
 
-static struct square_controller *sqc_arr[5] = {};
-static struct slide_controller *slc_arr[MAX_PARAMS_PER_GROUP * MAX_GROUPS] = {};
+static struct engine *engine; // the first part, the one that is shown
 
 static float pianokey_per_scancode[SDL_SCANCODE_COUNT] = {
     [SDL_SCANCODE_Z] = 1,  [SDL_SCANCODE_S] = 2,  [SDL_SCANCODE_X] = 3,  [SDL_SCANCODE_D] = 4,  [SDL_SCANCODE_C] = 5,
@@ -259,308 +96,225 @@ static float pianokey_per_scancode[SDL_SCANCODE_COUNT] = {
 };
 
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-static int waveform_written = 0;
 static SDL_FPoint points[WIDTH / X_STEP];
 static SDL_AudioStream *stream;
-static char *buf;
+static float *buf;
 static long long current_frame = 0;
 static int sample_frames;
 static int buffer_frames;
 static size_t frame_size;
-static const SDL_AudioSpec input_spec = {.channels = 1, .format = SDL_AUDIO_S16, .freq = 44100};
+// Rendered directly in the format, channel count and rate of the device so the stream does no conversion.
+static SDL_AudioSpec render_spec = {.channels = 2, .format = SDL_AUDIO_F32, .freq = 44100};
 
 static size_t calc_frame_size(const SDL_AudioSpec *spec)
 {
     return spec->channels * SDL_AUDIO_BYTESIZE(spec->format);
 }
 
-static void main_save_settings(FILE *f)
-{
-    int i = 0;
-    struct ctrl_param_group *pg;
-    while ((pg = param_groups[i++]))
-    {
-        struct ctrl_param *p;
-        int j = 0;
-        while ((p = pg->params[j++]))
-        {
-            fprintf(f, "%s = %f\n", p->label, p->value);
-        }
-    }
-}
 static void save_settings()
 {
     char filename[] = DEFAULT_SETTINGS_FILE_NAME;
     FILE *f = fopen(filename, "w");
     if (f)
     {
-        main_save_settings(f);
-        fm_save_settings(f);
+        param_save(f);
         fclose(f);
     }
 }
 
-static bool main_read_setting(char *line)
+static void load_settings(const char *filename)
 {
-    int i = 0;
-    struct ctrl_param_group *pg;
-    bool ret = false;
-    while ((pg = param_groups[i++]))
+    int n = param_load(filename);
+    if (n < 0)
     {
-        struct ctrl_param *p;
-        int j = 0;
-        while ((p = pg->params[j++]))
-        {
-            int len = strlen(p->label);
-            char tmp = line[len];
-            if (line[len + 1] != '=')
-                continue;
-            line[len] = '\0';
-            if (0 == strcmp(line, p->label))
-            {
-                int s = 0;
-                struct slide_controller *slc;
-                p->value = atof(&line[len + 3]);
-                line[len] = tmp;
-                printf("%s: %s Read %s with value %f\n", __func__, line, p->label, p->value);
-                ret = true;
-                for (s = 0; (slc = slc_arr[s]); s++)
-                {
-                    slide_controller_set_pos_from_value(slc);
-                }
-                break;
-            }
-            line[len] = tmp;
-        }
+        printf("Failed to open \"%s\"\n", filename);
+        return;
     }
-    return ret;
+    // The sliders pick up the new values the next time they are drawn.
+    printf("%s: Read %d settings from \"%s\"\n", __func__, n, filename);
 }
 
-static void load_settings(char *filename)
+// The computer keyboard plays the first part and edits its sequencer, at the start of the next block it renders. The
+// ui thread queues the keys so that no audio callback ever waits for it.
+static struct event_queue ui_events;
+
+static void queue_key(enum synth_event_type type, int key, float value)
 {
-    char c;
-    int i = 0;
-    char line[LINE_LEN + 1];
-    FILE *f = fopen(filename, "r");
-    if (!f)
-    {
-        printf("Failed to open \"%s\"\n", filename);
-        return;
-    }
-    while (fread(&c, 1, 1, f) && c != EOF)
-    {
-        if (c == '\n')
-        {
-            line[i] = '\0';
-            if (main_read_setting(line) || fm_read_setting(line))
-            {
-            }
-            i = 0;
-            continue;
-        }
-        line[i++] = c;
-    }
+    struct synth_event ev = {.type = type, .key = key, .value = value};
+
+    if (!event_queue_push(&ui_events, &ev))
+        fprintf(stderr, "%s: key queue full, key %d dropped\n", __func__, key);
 }
 
 static void key_press(int key)
 {
-    struct voice *oldest_voice = &voices[0];
+    queue_key(SYNTH_EVENT_NOTE_ON, key, 1.0);
+}
 
-    // notes higher that 0x53 are really bad so no need to even try
-    if (key >= 0x53)
-        return;
-    pthread_mutex_lock(&mutex);
-    // find oldest empty spot and if key is already in the array
-    for (int i = 0; i < NBR_VOICES; i++)
-    {
-        struct voice *voice = &voices[i];
-        // compare current to oldest
-        if (oldest_voice->released > voice->released)
-        {
-            oldest_voice = voice;
-        }
-        else if (oldest_voice->released == voice->released && oldest_voice->pressed > voice->pressed)
-        {
-            oldest_voice = voice;
-        }
+static void key_release(int key)
+{
+    queue_key(SYNTH_EVENT_NOTE_OFF, key, 0.0);
+}
 
-        if (voice->key == key)
-        {
-            if (voice->released <= current_frame)
-            {
-                oldest_voice = voice;
-                break;
-            }
-            pthread_mutex_unlock(&mutex);
-            return;
-        }
+// All notes off, like controller 123 from MIDI.
+static void notes_off()
+{
+    queue_key(SYNTH_EVENT_CONTROL, 123, 0.0);
+}
+
+// Plays the keys queued by the ui thread, on the audio thread.
+static void play_keys(struct engine *e, long long frame)
+{
+    struct synth_event ev;
+
+    while (event_queue_peek(&ui_events, &ev))
+    {
+        if (ev.type == SYNTH_EVENT_NOTE_ON)
+            engine_note_on(e, ev.key, ev.value, frame);
+        else if (ev.type == SYNTH_EVENT_NOTE_OFF)
+            engine_note_off(e, ev.key, frame);
+        else if (ev.type == SYNTH_EVENT_SEQ_RUN)
+            sequencer_toggle_run(&e->seq);
+        else if (ev.type == SYNTH_EVENT_SEQ_INPUT)
+            sequencer_input(&e->seq, ev.key, ev.value);
+        else
+            engine_control(e, ev.key, ev.value, frame);
+        event_queue_pop(&ui_events);
     }
+}
 
-    envelope_start(&oldest_voice->env, current_frame);
-    oldest_voice->released = INT64_MAX;
-    oldest_voice->pressed = current_frame;
+// Everything the engine is played goes into the journal when one is recorded.
+static void journal_tap(enum engine_input input, int key, float value, long long frame)
+{
+    static const enum journal_type types[] = {
+        [ENGINE_NOTE_ON] = JOURNAL_NOTE_ON, [ENGINE_NOTE_OFF] = JOURNAL_NOTE_OFF, [ENGINE_CONTROL] = JOURNAL_CONTROL};
 
-    oldest_voice->key = key;
-    pthread_mutex_unlock(&mutex);
+    if (input == ENGINE_BLOCK)
+        journal_block(frame, key);
+    else
+        journal_record(types[input], key, value, frame);
 }
 
-static void voice_off(struct voice *voice)
+static struct event_queue midi_events;
+static struct event_queue backend_events; // MIDI that comes with the audio, queued and played on the audio thread
+
+// Fills in a note or controller event from msg. Returns false for every other message.
+static bool note_event(const struct midi_message *msg, struct synth_event *ev)
 {
-    if (env_to_amp.value > 0.5)
+    if (msg->type == MIDI_MSG_NOTE_ON || msg->type == MIDI_MSG_NOTE_OFF)
     {
-        envelope_release(&voice->env, current_frame);
+        ev->type = msg->type == MIDI_MSG_NOTE_ON ? SYNTH_EVENT_NOTE_ON : SYNTH_EVENT_NOTE_OFF;
+        ev->key = msg->note.key;
+        ev->value = msg->note.velocity;
+        return true;
     }
-    else
+    if (msg->type == MIDI_MSG_CONTROL_CHANGE)
     {
-        voice->key = 0;
+        ev->type = SYNTH_EVENT_CONTROL;
+        ev->key = msg->control.number;
+        ev->value = msg->control.value;
+        return true;
     }
-    voice->released = current_frame;
+    return false;
 }
 
-static void key_release(int key)
+// Bank Select and Program Change on a channel of part 0 pick the preset. Returns false for every other message.
+static bool preset_message(const struct midi_message *msg)
 {
-    pthread_mutex_lock(&mutex);
-    for (int i = 0; i < NBR_VOICES; i++)
+    if (!parts_listens(0, msg->channel))
+        return false;
+    if (msg->type == MIDI_MSG_PROGRAM_CHANGE)
     {
-        struct voice *voice = &voices[i];
-        if (voice->key == key)
-        {
-            if (voice->released > current_frame)
-            {
-                voice_off(voice);
-                pthread_mutex_unlock(&mutex);
-                return;
-            }
-        }
+        bank_program_change(msg->program);
+        return true;
     }
-    pthread_mutex_unlock(&mutex);
+    return msg->type == MIDI_MSG_CONTROL_CHANGE && bank_control(msg->control.number, msg->control.value);
 }
 
-static void note_change(int key_on, int key_off)
+// Routes the events that are due at frame to the parts and returns how many frames there are until the next one.
+static int route_events(struct event_queue *q, long long frame, int frames)
 {
-    key_release(key_off);
-    key_press(key_on);
-};
+    struct synth_event ev;
 
-static void notes_off()
-{
-    pthread_mutex_lock(&mutex);
-    for (int i = 0; i < NBR_VOICES; i++)
+    while (event_queue_peek(q, &ev))
     {
-        struct voice *voice = &voices[i];
-        if (voice->released > current_frame)
-        {
-            voice_off(voice);
-        }
+        if (ev.frame > frame)
+            return min(ev.frame - frame, (long long)frames);
+        parts_route(&ev);
+        event_queue_pop(q);
     }
-    pthread_mutex_unlock(&mutex);
+    return frames;
 }
 
-static float render_sample(const long long current_frame, const SDL_AudioSpec *spec)
+// Routes a message from the MIDI file, on the audio thread.
+static void play_message(const struct midi_message *msg, long long frame)
 {
-    float sample = 0.0;
-    for (int i = 0; i < NBR_VOICES; i++)
-    {
-        struct voice *voice = &voices[i];
-        if (voice->key != 0)
-        {
-            float raw_sample = 0.0;
-            float freq = key_to_freq[voice->key][0];
-            if (osc_type.value == OSC_TYPE_FM)
-            {
-                raw_sample = amplitude.value * fm_render_sample(current_frame - voice->pressed, spec, freq);
-            }
-            else
-            {
-                raw_sample =
-                    amplitude.value * osc_render_sample(current_frame, &voice->osc, spec, voice->key, osc_type.value);
-            }
-
-            // envelope
-            if (env_to_amp.value > 0.5)
-            {
-                raw_sample = raw_sample * envelope_get(&voice->env, A.value, D.value, S.value, R.value, current_frame);
-            }
-            else
-            {
-                if (0.0 == envelope_get(&voice->env, A.value, D.value, S.value, R.value, current_frame))
-                    voice->key = 0;
-            }
-            // filter
-            int cut_freq = min(17000, max(50, key_to_cutoff.value * key_to_freq[voice->key][0] + cutoff.value +
-                                                  env_to_cutoff.value * envelope_get(&voice->env, A.value, D.value,
-                                                                                     S.value, R.value, current_frame) +
-                                                  cutoff_lfo_amp.value * cosine_render_sample(current_frame, spec,
-                                                                                              cutoff_lfo_freq.value)));
-            low_pass_filter_configure(&voice->filter, cut_freq, resonance.value, spec->freq);
-            sample += low_pass_filter_get_output(&voice->filter, raw_sample);
-        }
-    }
-
-    // distort
-    sample = distort(sample, dist_level.value, flip_level.value);
+    struct synth_event ev = {.frame = frame, .channel = msg->channel};
 
-    // echo
-    sample += delay_fb.value * delay_get_sample(delay_ms.value, spec);
-    delay_put_sample(sample);
+    if (!preset_message(msg) && note_event(msg, &ev))
+        parts_route(&ev);
+}
 
-    // chorus
-    float chorus_delay_ms = 3.0 + 1.0 * cosine_render_sample(current_frame, spec, chorus_freq.value);
-    sample += chorus_amount.value * delay_get_sample(chorus_delay_ms, spec);
+// Hands everything from MIDI and the MIDI file that is due before frame + frames to the parts, in frame order, so
+// that each part plays it on its own thread.
+static void route_input(long long frame, int frames)
+{
+    long long end = frame + frames;
 
-    sample = distort(sample, 0.999, 100.0);
+    while (frame < end)
+    {
+        int n = route_events(&midi_events, frame, end - frame);
+        n = route_events(&backend_events, frame, n);
+        frame += smf_advance(frame, n, play_message);
+    }
+}
 
-    return sample;
+// Plays a record from the journal being replayed, on the audio thread.
+static void replay_record(const struct journal_record *rec, long long frame)
+{
+    if (rec->type == JOURNAL_NOTE_ON)
+        engine_note_on(engine, rec->key, rec->value, frame);
+    else if (rec->type == JOURNAL_NOTE_OFF)
+        engine_note_off(engine, rec->key, frame);
+    else if (rec->type == JOURNAL_CONTROL)
+        engine_control(engine, rec->key, rec->value, frame);
 }
 
-static void write_sample(float sample, char **buf, const SDL_AudioSpec *spec)
+// What plays the first part besides its events, at the start of every block.
+static int engine_input(struct engine *e, long long frame, int frames, void *arg)
 {
-    int16_t *out = (int16_t *)*buf;
-    *out = (int16_t)(sample * 0x7FFF);
-    *buf += 2;
+    // Parameters from a preset or a replay go in before the block takes them.
+    bank_apply();
+    play_keys(e, frame);
+    return journal_replay_advance(frame, frames, replay_record);
 }
 
-static bool render_sample_frames(long long *current_frame, int frames, char *buf, const SDL_AudioSpec *spec)
+// Hands the rendered frames to the scope, mixed down to one channel.
+static void write_scope(long long start_frame, const float *buf, int frames, const SDL_AudioSpec *spec)
 {
-    int s, c, i = 0;
-    float sample;
-    struct voice *lowest_voice = NULL;
-    { // Find the key for which we generate the visualization.
-        for (i = 0; i < NBR_VOICES; i++)
-        {
-            if (voices[i].pressed < voices[i].released && (!lowest_voice || lowest_voice->key > voices[i].key))
-                lowest_voice = &voices[i];
-        }
-    }
+    float samples[ENGINE_BLOCK_FRAMES];
 
-    for (s = 0; s < frames; s++)
+    while (frames > 0)
     {
+        int n = min(frames, ENGINE_BLOCK_FRAMES);
+        for (int s = 0; s < n; s++, buf += spec->channels)
+            samples[s] = spec->channels == 1 ? buf[0] : 0.5 * (buf[0] + buf[1]);
+        scope_write(start_frame, samples, n);
+        start_frame += n;
+        frames -= n;
+    }
+}
 
-        // what is going on with channels here? only one buffer so it seems a bit
-        // broken if multiple channels.
-        for (c = 0; c < spec->channels; c++)
-        {
-            sample = render_sample(*current_frame, spec);
-            write_sample(sample, &buf, spec);
-        }
-
-        // write to visualisation buffer
-        {
-            int lowest_key = lowest_voice ? lowest_voice->key : 1;
-            int samples_per_period = spec->freq / (key_to_freq[lowest_key][0]);
-            bool period_start = *current_frame % samples_per_period == 0;
-            bool on_grid = (*current_frame % max(1, (samples_per_period / WAVEFORM_LEN)) == 0);
+static bool render_sample_frames(long long *current_frame, int frames, float *buf, const SDL_AudioSpec *spec)
+{
+    long long start_frame = *current_frame;
 
-            if ((waveform_written == 0 && period_start) ||
-                (waveform_written > 0 && waveform_written < WAVEFORM_LEN && on_grid))
-            {
-                points[waveform_written].y = HEIGHT / 2 + HEIGHT / 2 * sample;
-                waveform_written++;
-            }
-        }
+    // The visualization follows the lowest key.
+    scope_set_period(spec->freq / (key_to_freq[engine_lowest_key(engine)][0]));
 
-        *current_frame += 1;
-    }
+    route_input(start_frame, frames);
+    parts_render(current_frame, frames, buf, engine_input, NULL);
+    write_scope(start_frame, buf, frames, spec);
 
     return true;
 }
@@ -572,80 +326,247 @@ static unsigned calc_frames_queued(SDL_AudioStream *stream, const SDL_AudioSpec
 
 static void fill_audio_buffer(union sigval)
 {
-    pthread_mutex_lock(&mutex);
+    // The timer may hand each expiry to a fresh thread, so this is done on every call.
+    realtime_thread_enter();
+    rt_check_enter();
+
+    // Held only while starting and stopping, the next expiry fills in what this one leaves out.
+    if (pthread_mutex_trylock(&mutex))
+    {
+        rt_check_leave();
+        return;
+    }
     // check how much is in buffer
     // render rest
-    int frames = sample_frames - calc_frames_queued(stream, &input_spec);
-    frames = min(frames, buffer_frames);
-    if (frames > 0)
+    int queued = calc_frames_queued(stream, &render_spec);
+    int frames = min(sample_frames - queued, buffer_frames);
+
+    frame_clock_update(current_frame - queued);
+    // A timer expiry that was already on its way at shutdown finds the parts stopped.
+    if (frames > 0 && !synth_abort)
     {
-        render_sample_frames(&current_frame, frames, buf, &input_spec);
+        render_sample_frames(&current_frame, frames, buf, &render_spec);
         if (!SDL_PutAudioStreamData(stream, buf, frame_size * frames))
         {
-            pr_sdl_err();
+            diag_post(DIAG_AUDIO_STREAM_ERROR, frames, 0);
         }
     }
     pthread_mutex_unlock(&mutex);
+    rt_check_leave();
+}
+
+#ifdef SYNTH_ONE_JACK
+// Called from the JACK process callback, before jack_render() for the same period.
+static void jack_midi(const struct midi_message *msg, int offset, void *arg)
+{
+    struct synth_event ev = {.frame = current_frame + offset, .channel = msg->channel};
+
+    if (!preset_message(msg) && note_event(msg, &ev) && !event_queue_push(&backend_events, &ev))
+        diag_post(DIAG_MIDI_DROPPED, ev.type, ev.frame);
 }
 
-static void trigger_draw_video_event(union sigval)
+// Called from the JACK process callback. JACK sets the pace, every period is rendered as it is asked for.
+static void jack_render(float *out, int frames, void *arg)
+{
+    // What is rendered now is heard after the period that is playing.
+    frame_clock_update(current_frame - buffer_frames);
+    // The parts render at most buffer_frames at a time, the server may have changed its period since.
+    for (int n; frames > 0; frames -= n, out += n * render_spec.channels)
+    {
+        n = min(frames, buffer_frames);
+        render_sample_frames(&current_frame, n, out, &render_spec);
+    }
+}
+
+#endif
+
+// The backend lost its device or server, nothing is played any more.
+static void backend_shutdown(void *arg)
+{
+    synth_abort = true;
+}
+
+// Opens the JACK client, the server decides the rate and the period.
+static int open_jack()
+{
+#ifdef SYNTH_ONE_JACK
+    struct jack_io_config config = {.name = "synth_one",
+                                    .channels = JACK_IO_MAX_CHANNELS,
+                                    .connect = true,
+                                    .midi_cb = jack_midi,
+                                    .render_cb = jack_render,
+                                    .shutdown_cb = backend_shutdown};
+    int period_frames;
+
+    if (jack_io_open(&config, &render_spec.freq, &period_frames))
+        return -1;
+    render_spec.channels = config.channels;
+    sample_frames = 2 * period_frames;
+    printf("JACK, channels %d, freq %d, period %d frames\n", render_spec.channels, render_spec.freq, period_frames);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+static int start_jack()
+{
+#ifdef SYNTH_ONE_JACK
+    // Events are played one period after the one they arrive in, like with the timer.
+    frame_clock_init(render_spec.freq, sample_frames);
+    frame_clock_update(0);
+    printf("MIDI latency %d frames\n", sample_frames);
+    return jack_io_start();
+#else
+    return -1;
+#endif
+}
+
+static void stop_jack()
+{
+#ifdef SYNTH_ONE_JACK
+    jack_io_stop();
+#endif
+}
+
+// Called from the ALSA playback thread with the period it is about to commit to the device.
+static void alsa_render(float *out, int frames, int queued, void *arg)
+{
+    frame_clock_update(current_frame - queued);
+    render_sample_frames(&current_frame, frames, out, &render_spec);
+}
+
+static int open_alsa(struct alsa_pcm_config *config)
+{
+    config->sample_rate = DEFAULT_ALSA_RATE;
+    config->channels = render_spec.channels;
+    config->render_cb = alsa_render;
+    config->shutdown_cb = backend_shutdown;
+    if (alsa_pcm_open(config))
+        return -1;
+    render_spec.freq = config->sample_rate;
+    render_spec.channels = config->channels;
+    // The parts render a period at a time.
+    sample_frames = 2 * config->period_frames;
+    return 0;
+}
+
+static int start_alsa(const struct alsa_pcm_config *config, pthread_attr_t *attr)
+{
+    // Events are played one device buffer after they arrive, never before what is rendered next.
+    frame_clock_init(render_spec.freq, config->buffer_frames);
+    frame_clock_update(0);
+    printf("MIDI latency %d frames\n", config->buffer_frames);
+    return alsa_pcm_start(attr);
+}
+
+// Parses "period[:buffer]" in frames.
+static int parse_period(const char *spec, struct alsa_pcm_config *config)
+{
+    char *end;
+    long period = strtol(spec, &end, 10);
+    long buffer = 0;
+
+    if (end == spec || period <= 0)
+        return -1;
+    if (*end == ':')
+    {
+        buffer = strtol(end + 1, &end, 10);
+        if (buffer < period)
+            return -1;
+    }
+    if (*end)
+        return -1;
+    config->period_frames = period;
+    config->buffer_frames = buffer;
+    return 0;
+}
+
+static void push_user_event(enum user_event_code code, void *data1, void *data2)
 {
     SDL_Event user_event;
     SDL_zero(user_event); /* SDL will copy this entire struct! Initialize to keep
                              memory checkers happy. */
     user_event.type = SDL_EVENT_USER;
-    user_event.user.code = 1;
-    user_event.user.data1 = NULL;
-    user_event.user.data2 = NULL;
+    user_event.user.code = code;
+    user_event.user.data1 = data1;
+    user_event.user.data2 = data2;
     SDL_PushEvent(&user_event);
 }
 
 static void draw_waveform(SDL_Renderer *renderer)
 {
     int i;
-    float time_scale_factor = 3.0;
+    float waveform[WAVEFORM_LEN];
 
-    // draw every 5:th pixel of the window in x
-
-    pthread_mutex_lock(&mutex);
-    if (waveform_written == WAVEFORM_LEN)
+    // Keep the last waveform if the scope has nothing new.
+    if (scope_read(waveform, WAVEFORM_LEN) == WAVEFORM_LEN)
     {
-        struct square_controller *sqc;
-        struct slide_controller *slc;
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-        SDL_RenderClear(renderer);
-        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-        SDL_RenderLines(renderer, points, WIDTH / X_STEP);
+        for (i = 0; i < WAVEFORM_LEN; i++)
+            points[i].y = HEIGHT / 2 + HEIGHT / 2 * waveform[i];
+    }
 
-        for (i = 0; (sqc = sqc_arr[i]); i++)
-        {
-            square_controller_draw(renderer, sqc);
-        }
-        for (i = 0; (slc = slc_arr[i]); i++)
-        {
-            slide_controller_draw(renderer, slc);
-        }
+    ui_show_panel(UI_PANEL_FM, engine->p.osc_type.value == OSC_TYPE_FM);
+    ui_show_panel(UI_PANEL_OSC, engine->p.osc_type.value != OSC_TYPE_FM);
 
-        sequencer_draw(renderer);
+    // Only the parts of the ui that changed are redrawn, the waveform goes on top of it every frame.
+    ui_draw(renderer);
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderLines(renderer, points, WIDTH / X_STEP);
 
-        switch ((int)osc_type.value)
-        {
-        case OSC_TYPE_FM:
-            fm_draw(renderer);
-            break;
-        case OSC_TYPE_PULSE:
-        case OSC_TYPE_SAW:
-            osc_draw(renderer);
-            break;
-        default:
-            fprintf(stderr, "Invalid oscillator type\n");
-        }
+    SDL_RenderPresent(renderer);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-r] [-R] [-P priority] [-C cpus] [-M client:port]... [-x] [-K client:port]... [-m file.mid]\n"
+            "          [-O out.wav] [-J journal] [-j journal] [-B bank] [-p preset] [-X route]... [-T part]...\n"
+            "          [-a backend] [-b period[:buffer]] [settings file]\n"
+            "  -r           real-time mode, SCHED_FIFO audio thread and locked memory\n"
+            "  -R           use SCHED_RR instead of SCHED_FIFO, implies -r\n"
+            "  -P priority  real-time priority, 1-99 (default %d)\n"
+            "  -C cpus      pin the audio thread to cpus, like \"2\" or \"2-3\"\n"
+            "  -M port      connect the MIDI input to a sequencer port, like \"20:0\", may be repeated\n"
+            "  -x           follow MIDI clock, start and stop from the input\n"
+            "  -K port      send MIDI clock to a sequencer port, may be repeated\n"
+            "  -m file.mid  play a standard MIDI file, type 0 or 1\n"
+            "  -O out.wav   render the MIDI file to out.wav as fast as possible instead of playing it\n"
+            "  -J journal   record every note, controller and parameter change to journal\n"
+            "  -j journal   replay journal, with -O, to reproduce a recorded session\n"
+            "  -B bank      map a preset bank built with mkbank, MIDI bank select and program change pick the preset\n"
+            "  -p preset    start with the preset of this name from the bank\n"
+            "  -X route     add a modulation route, source:LABEL:amount, like \"velocity:LINEAR GAIN:0.5\" or\n"
+            "               \"cc1:CUTOFF:4000\", sources are env, lfo, velocity, key and ccN, may be repeated\n"
+            "  -T part      add a part, channel[:low-high][,settings], channel 1-16 or 0 for all, like\n"
+            "               \"2:0-40,bass.txt\", up to %d, the first part is the one shown and saved\n"
+            "  -a backend   play through sdl, jack or alsa[:device] (default sdl), jack needs a build with\n"
+            "               SYNTH_ONE_JACK, alsa writes straight to a PCM device like \"hw:0,0\" (default %s)\n"
+            "  -b frames    ALSA period and buffer size, like \"128:256\" (default %d, buffer two periods)\n",
+            name, DEFAULT_RT_PRIORITY, PARTS_MAX, DEFAULT_ALSA_DEVICE, DEFAULT_ALSA_PERIOD_FRAMES);
+}
 
-        SDL_RenderPresent(renderer);
-        waveform_written = 0;
+// Adds a part from "channel[:low-high][,settings]" and points settings at its settings file, if it has one.
+static int add_part(const char *spec, const char **settings)
+{
+    char *end;
+    long channel = strtol(spec, &end, 10);
+    long lo = 0, hi = 127;
+
+    if (end == spec || channel < 0 || channel > 16)
+        return -1;
+    if (*end == ':')
+    {
+        lo = strtol(end + 1, &end, 10);
+        if (*end != '-')
+            return -1;
+        hi = strtol(end + 1, &end, 10);
     }
+    if ((*end && *end != ',') || lo > hi)
+        return -1;
+    *settings = *end == ',' ? end + 1 : NULL;
 
-    pthread_mutex_unlock(&mutex);
+    return parts_add(channel ? channel - 1 : PART_OMNI, lo, hi) ? 0 : -1;
 }
 
 static void sig_handler(int signum)
@@ -654,10 +575,11 @@ static void sig_handler(int signum)
     synth_abort = true;
 }
 
-static int setup_audio_timer(timer_t *t)
+static int setup_audio_timer(timer_t *t, pthread_attr_t *attr)
 {
-    struct sigevent sevnt = {.sigev_notify = SIGEV_THREAD, .sigev_notify_function = fill_audio_buffer};
-    struct itimerspec new_value = {.it_interval = {.tv_nsec = buffer_frames / 2 * 1000000000ull / input_spec.freq}};
+    struct sigevent sevnt = {
+        .sigev_notify = SIGEV_THREAD, .sigev_notify_function = fill_audio_buffer, .sigev_notify_attributes = attr};
+    struct itimerspec new_value = {.it_interval = {.tv_nsec = buffer_frames / 2 * 1000000000ull / render_spec.freq}};
     new_value.it_value = new_value.it_interval;
 
     int ret = timer_create(CLOCK_MONOTONIC, &sevnt, t);
@@ -672,129 +594,193 @@ static int setup_audio_timer(timer_t *t)
     return 0;
 }
 
-static int setup_video_timer(timer_t *t)
+static int setup_redraw_timer()
 {
     int i;
-    struct sigevent sevnt = {.sigev_notify = SIGEV_THREAD, .sigev_notify_function = trigger_draw_video_event};
+    int fd;
+    struct itimerspec new_value = {.it_interval = {.tv_nsec = REDRAW_INTERVAL_NS}};
+    new_value.it_value = new_value.it_interval;
 
     // initialize the points that shall be drawn
     for (i = 0; i < WAVEFORM_LEN; i++)
         points[i].x = i * X_STEP;
 
-    struct itimerspec new_value = {.it_interval = {.tv_nsec = 100000000ull / 8}};
-    new_value.it_value = new_value.it_interval;
-
-    int ret = timer_create(CLOCK_MONOTONIC, &sevnt, t);
-    if (ret)
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (fd < 0)
     {
-        perror("Failed to create video timer!");
+        perror("Failed to create redraw timer!");
         return -1;
     }
 
-    timer_settime(*t, 0, &new_value, NULL);
+    timerfd_settime(fd, 0, &new_value, NULL);
 
-    return 0;
+    return fd;
 }
 
-int main(int argc, char **argv)
+static int redraw_fd = -1;
+static atomic_bool redraw_pending = false;
+
+// Turns redraw timer expiries into SDL events, so the main loop can block in SDL_WaitEvent() for all of its input.
+// It also checks synth_abort at least every REDRAW_POLL_TIMEOUT_MS and wakes the main loop up to quit.
+static void *redraw_thread(void *arg)
 {
-    SDL_AudioDeviceID devId;
-    bool res;
-    SDL_AudioSpec output_spec;
-    SDL_Window *window;
-    timer_t audio_timer;
-    timer_t video_timer;
+    struct pollfd fds[1] = {{.fd = redraw_fd, .events = POLLIN}};
 
-    if (!SDL_Init(SDL_INIT_EVENTS | SDL_INIT_AUDIO | SDL_INIT_VIDEO))
+    while (!synth_abort)
     {
-        pr_sdl_err();
-        return -2;
-    }
+        if (poll(fds, 1, REDRAW_POLL_TIMEOUT_MS) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("Redraw poll failed!");
+            break;
+        }
 
-    signal(SIGINT, sig_handler);
+        if (fds[0].revents & POLLIN)
+        {
+            uint64_t expirations;
+            if (read(redraw_fd, &expirations, sizeof(expirations)) > 0 && !atomic_exchange(&redraw_pending, true))
+                push_user_event(USER_EVENT_REDRAW, NULL, NULL);
+        }
+    }
 
-    // VIDEO STUFF
-    window = SDL_CreateWindow("Synth One",      // window title
-                              WIDTH,            // width, in pixels
-                              HEIGHT,           // height, in pixels
-                              SDL_WINDOW_OPENGL // flags - see below
-    );
-    if (!window)
+    // SIGINT and a lost audio backend only set synth_abort.
+    if (synth_abort)
     {
-        pr_sdl_err();
-        return -1;
+        SDL_Event quit_event;
+        SDL_zero(quit_event);
+        quit_event.type = SDL_EVENT_QUIT;
+        SDL_PushEvent(&quit_event);
     }
+    return NULL;
+}
 
-    SDL_Renderer *renderer = SDL_CreateRenderer(window, NULL);
-    if (!renderer)
+static struct event_queue clock_out_events;
+static struct midi_clock clock_in;
+static int clock_in_ticks = 0;
+static double clock_in_bpm = 0.0; // the last tempo the filtered clock was locked to
+static bool follow_clock = false;
+
+static void queue_event(const struct synth_event *ev)
+{
+    if (!event_queue_push(&midi_events, ev))
+        fprintf(stderr, "%s: event queue full, event %d dropped\n", __func__, ev->type);
+}
+
+// Every step worth of ticks from the filtered clock becomes a step event, on the frame the filtered tick maps to.
+// The loop is still locking on the first ticks after a start or a pause, those steps play on time anyway and only
+// their gate length comes from the last known tempo, or the internal one before any was known.
+static void clock_tick(long long ns)
+{
+    long long tick_ns = midi_clock_tick(&clock_in, ns);
+    int clocks_per_step = MIDI_CLOCKS_PER_BEAT / 4;
+
+    if (clock_in_ticks++ % clocks_per_step == 0)
     {
-        pr_sdl_err();
-        return 1;
+        struct synth_event ev = {.frame = frame_clock_frame_at(tick_ns), .type = SYNTH_EVENT_CLOCK_STEP};
+        double bpm = midi_clock_bpm(&clock_in);
+
+        if (bpm > 0.0)
+            clock_in_bpm = bpm;
+        else
+            bpm = clock_in_bpm > 0.0 ? clock_in_bpm : engine->p.bpm.value;
+        ev.value = sequencer_frames_per_step(bpm, render_spec.freq);
+        queue_event(&ev);
     }
+}
 
-    text_init(renderer);
+// Called on the MIDI thread. Notes and transport are queued for the audio thread at the frame matching their kernel
+// timestamp.
+static void midi_event(const struct midi_message *msg, long long ns, void *arg)
+{
+    struct synth_event ev = {.frame = frame_clock_frame_at(ns), .channel = msg->channel};
 
-    pthread_mutex_lock(&mutex);
+    switch (msg->type)
     {
-        int i = 0;
-        int j = 0;
-        int k = 0;
-        struct ctrl_param_group *pg;
-        struct ctrl_param *p;
-        const int margin = 10;
-        const int width = 100;
-        const int height = 10;
-        int label_height = text_get_height();
-        int tot_height = height + label_height;
-        int x = margin;
-        int y = margin;
-        while ((pg = param_groups[i++]))
+    case MIDI_MSG_NOTE_ON:
+    case MIDI_MSG_NOTE_OFF:
+    case MIDI_MSG_CONTROL_CHANGE:
+    case MIDI_MSG_PROGRAM_CHANGE:
+        if (!preset_message(msg) && note_event(msg, &ev))
+            queue_event(&ev);
+        break;
+    case MIDI_MSG_CLOCK:
+        if (follow_clock)
+            clock_tick(ns);
+        break;
+    case MIDI_MSG_START:
+    case MIDI_MSG_CONTINUE:
+    case MIDI_MSG_STOP:
+        if (!follow_clock)
+            break;
+        // A start is the first tick of a new song position, the loop locks on again from it.
+        if (msg->type == MIDI_MSG_START)
         {
-            j = 0;
-            while ((p = pg->params[j++]))
-            {
-                x = margin + y / (HEIGHT - tot_height) * (WIDTH - 2 * margin - width);
-                struct linear_control placeholder = {&p->value, p->min, p->max, p->quantized_to_int};
-                slc_arr[k++] = slide_controller_create(x, y % (HEIGHT - tot_height), width, height,
-                                                       (struct linear_control)placeholder, p->label);
-                y += (margin + height + label_height);
-            }
-            y += 3 * margin;
+            clock_in_ticks = 0;
+            midi_clock_init(&clock_in);
         }
+        ev.type = msg->type == MIDI_MSG_START      ? SYNTH_EVENT_START
+                  : msg->type == MIDI_MSG_CONTINUE ? SYNTH_EVENT_CONTINUE
+                                                   : SYNTH_EVENT_STOP;
+        queue_event(&ev);
+        break;
+    default:
+        break;
     }
-    pthread_mutex_unlock(&mutex);
-
-    if ((res = setup_video_timer(&video_timer)))
-        return res;
+}
 
-    // initialization of sub modules
-    fm_init(200, 200);
-    delay_init(&input_spec, MAX_DELAY_MS);
-    sequencer_init(note_change);
+// Hands the clock the sequencer produced to the MIDI thread, timed to when the frame it was rendered at is heard.
+static bool midi_out(struct midi_message *msg, long long *ns, void *arg)
+{
+    struct synth_event ev;
 
-    // MIDI STUFF
-    snd_rawmidi_t *midi_in = midi_start();
+    if (!event_queue_peek(&clock_out_events, &ev))
+        return false;
+    event_queue_pop(&clock_out_events);
 
-    // SETTINGS
-    if (argc == 2)
-        load_settings(argv[1]);
-    else
-        load_settings(DEFAULT_SETTINGS_FILE_NAME);
+    msg->type = ev.type == SYNTH_EVENT_START  ? MIDI_MSG_START
+                : ev.type == SYNTH_EVENT_STOP ? MIDI_MSG_STOP
+                                              : MIDI_MSG_CLOCK;
+    msg->channel = 0;
+    *ns = frame_clock_ns_at(ev.frame);
+    return true;
+}
 
-    // AUDIO STUFF
+// Renders the given number of frames of whatever the MIDI file or the journal plays, as fast as it goes.
+static int render_offline(const char *filename, long long frames)
+{
+    FILE *f = fopen(filename, "wb");
 
-    init_key_to_freq();
+    if (!f)
+    {
+        perror("Failed to open output file!");
+        return -1;
+    }
+    wav_write_header(f, render_spec.freq, render_spec.channels, frames);
 
-    for (int i = 0; i < NBR_VOICES; i++)
+    smf_start();
+    while (frames > 0)
     {
-        voices[i].pressed = 0;
-        voices[i].released = 0;
+        // A replay ends every chunk on a recorded block boundary, nothing else has any.
+        int n = journal_replay_chunk(current_frame, min(frames, (long long)buffer_frames));
+        render_sample_frames(&current_frame, n, buf, &render_spec);
+        fwrite(buf, frame_size, n, f);
+        frames -= n;
+    }
 
-        osc_init(&voices[i].osc, 200, 200);
-        envelope_init(&voices[i].env, &input_spec);
-        low_pass_filter_init(&voices[i].filter, res, cutoff.value, input_spec.freq);
+    if (fclose(f))
+    {
+        perror("Failed to write output file!");
+        return -1;
     }
+    printf("Rendered %lld frames to %s\n", current_frame, filename);
+    return 0;
+}
 
+static SDL_AudioDeviceID open_audio_device()
+{
+    SDL_AudioDeviceID devId = 0;
+    SDL_AudioSpec output_spec;
     int count;
     SDL_AudioDeviceID *ids = SDL_GetAudioPlaybackDevices(&count);
     for (int i = 0; i < count; i++)
@@ -806,23 +792,28 @@ int main(int argc, char **argv)
     if (!devId)
     {
         pr_sdl_err();
-        return 2;
+        return 0;
     }
 
     if (!SDL_GetAudioDeviceFormat(devId, &output_spec, &sample_frames))
     {
         pr_sdl_err();
-        return 3;
+        SDL_CloseAudioDevice(devId);
+        return 0;
     }
-    buffer_frames = sample_frames / 2;
-    frame_size = calc_frame_size(&input_spec);
-    printf("Frame size %ld\n", frame_size);
-    buf = malloc(buffer_frames * frame_size);
+    render_spec.freq = output_spec.freq;
+    render_spec.channels = output_spec.channels;
 
     printf("Audiodriver %s, id %u, channels %d, freq %d, frames %d, \n", SDL_GetCurrentAudioDriver(), devId,
            output_spec.channels, output_spec.freq, sample_frames);
+    return devId;
+}
 
-    if (!(stream = SDL_CreateAudioStream(&input_spec, &output_spec)))
+// Primes the stream, starts the device and the timer that keeps the stream filled. Returns 0 or the exit status.
+static int start_sdl_audio(SDL_AudioDeviceID devId, timer_t *audio_timer, pthread_attr_t *audio_thread_attr)
+{
+    // Same spec on both sides, the stream only hands the rendered buffers over to the device.
+    if (!(stream = SDL_CreateAudioStream(&render_spec, &render_spec)))
     {
         pr_sdl_err();
         return 4;
@@ -836,7 +827,7 @@ int main(int argc, char **argv)
 
     // render 2xsample_frames
     pthread_mutex_lock(&mutex);
-    render_sample_frames(&current_frame, buffer_frames, buf, &input_spec);
+    render_sample_frames(&current_frame, buffer_frames, buf, &render_spec);
 
     // write to stream
     if (!SDL_PutAudioStreamData(stream, buf, frame_size * buffer_frames))
@@ -850,133 +841,442 @@ int main(int argc, char **argv)
         pr_sdl_err();
         return 7;
     }
+    // Events are played one timer period after everything the device has queued, so they are never late.
+    frame_clock_init(render_spec.freq, sample_frames + buffer_frames / 2);
+    frame_clock_update(0);
+    printf("MIDI latency %d frames\n", sample_frames + buffer_frames / 2);
     pthread_mutex_unlock(&mutex);
 
-    if (res = setup_audio_timer(&audio_timer))
-        return res;
+    if (setup_audio_timer(audio_timer, audio_thread_attr))
+        return 1;
+    return 0;
+}
 
-    SDL_Event event;
-    while (!synth_abort)
+// The sliders of the shown part and the panels of its oscillators, FM and sequencer.
+static void add_widgets()
+{
+    pthread_mutex_lock(&mutex);
     {
-        while (SDL_PollEvent(&event))
+        int i = 0;
+        int j = 0;
+        struct ctrl_param_group *pg;
+        struct ctrl_param *p;
+        const int margin = 10;
+        const int width = 100;
+        const int height = 10;
+        int label_height = text_get_height();
+        int tot_height = height + label_height;
+        int x = margin;
+        int y = margin;
+        while ((pg = engine->p.groups[i++]))
         {
-            if (event.type == SDL_EVENT_KEY_DOWN)
+            j = 0;
+            while ((p = pg->params[j++]))
             {
-                int new_key;
-                switch (event.key.scancode)
-                {
-                case SDL_SCANCODE_SPACE:
-                    sequencer_toggle_run();
-                    notes_off();
-                    break;
-                case SDL_SCANCODE_ESCAPE:
-                    sequencer_toggle_edit();
-                    break;
-                default:
-                    new_key = pianokey_per_scancode[event.key.scancode];
-                    if (new_key != 0)
-                    {
-                        new_key += 12 * octave.value;
-                        key_press(new_key);
-                    }
-                    sequencer_input(new_key);
-                }
+                x = margin + y / (HEIGHT - tot_height) * (WIDTH - 2 * margin - width);
+                struct linear_control placeholder = {&p->value, p->min, p->max, p->quantized_to_int};
+                ui_add_slider(slide_controller_create(x, y % (HEIGHT - tot_height), width, height,
+                                                      (struct linear_control)placeholder, p->label),
+                              UI_PANEL_MAIN);
+                y += (margin + height + label_height);
             }
-            else if (event.type == SDL_EVENT_KEY_UP)
+            y += 3 * margin;
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+
+    fm_ui_init(&engine->fm, 200, 200);
+    osc_ui_init(&engine->osc, 200, 200);
+    sequencer_ui_init(&engine->seq);
+}
+
+int main(int argc, char **argv)
+{
+    SDL_AudioDeviceID devId = 0;
+    bool res;
+    int status;
+    SDL_Window *window;
+    SDL_Renderer *renderer = NULL;
+    timer_t audio_timer;
+    pthread_t redraw_tid;
+    pthread_attr_t audio_thread_attr;
+    struct realtime_config rt_config = {.priority = DEFAULT_RT_PRIORITY};
+    struct midi_config midi_config = {.event_cb = midi_event};
+    const char *smf_file = NULL;
+    const char *offline_file = NULL;
+    const char *journal_file = NULL;
+    const char *replay_file = NULL;
+    const char *bank_file = NULL;
+    const char *preset_name = NULL;
+    const char *mod_routes[MOD_MAX_ROUTES];
+    int nbr_mod_routes = 0;
+    const char *part_settings[PARTS_MAX] = {};
+    enum audio_backend backend = AUDIO_SDL;
+    struct alsa_pcm_config alsa_config = {.device = DEFAULT_ALSA_DEVICE, .period_frames = DEFAULT_ALSA_PERIOD_FRAMES};
+    SDL_InitFlags sdl_flags = SDL_INIT_EVENTS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "rRP:C:M:xK:m:O:J:j:B:p:X:T:a:b:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'R':
+            rt_config.round_robin = true;
+            // fall through
+        case 'r':
+            rt_config.enabled = true;
+            break;
+        case 'P':
+            rt_config.priority = atoi(optarg);
+            break;
+        case 'C':
+            rt_config.cpus = optarg;
+            break;
+        case 'M':
+            if (midi_config.nbr_in_ports == MIDI_MAX_PORTS)
             {
-                int new_key = pianokey_per_scancode[event.key.scancode];
-                if (new_key != 0)
-                {
-                    new_key += 12 * octave.value;
-                    key_release(new_key);
-                }
+                fprintf(stderr, "At most %d MIDI input ports\n", MIDI_MAX_PORTS);
+                usage(argv[0]);
+                return 1;
             }
-            else if (event.type == SDL_EVENT_USER)
+            midi_config.in_ports[midi_config.nbr_in_ports++] = optarg;
+            break;
+        case 'x':
+            follow_clock = true;
+            break;
+        case 'K':
+            if (midi_config.nbr_out_ports == MIDI_MAX_PORTS)
             {
-                draw_waveform(renderer);
+                fprintf(stderr, "At most %d MIDI clock output ports\n", MIDI_MAX_PORTS);
+                usage(argv[0]);
+                return 1;
             }
-            else if (event.type == SDL_EVENT_MOUSE_BUTTON_DOWN)
+            midi_config.out_ports[midi_config.nbr_out_ports++] = optarg;
+            midi_config.out_cb = midi_out;
+            break;
+        case 'm':
+            smf_file = optarg;
+            break;
+        case 'O':
+            offline_file = optarg;
+            break;
+        case 'J':
+            journal_file = optarg;
+            break;
+        case 'j':
+            replay_file = optarg;
+            break;
+        case 'B':
+            bank_file = optarg;
+            break;
+        case 'p':
+            preset_name = optarg;
+            break;
+        case 'X':
+            if (nbr_mod_routes == MOD_MAX_ROUTES)
             {
-                int i;
-                struct square_controller *sqc;
-                struct slide_controller *slc;
-                for (i = 0; (sqc = sqc_arr[i]); i++)
-                {
-                    square_controller_click(sqc, event.button.x, event.button.y);
-                }
-                for (i = 0; (slc = slc_arr[i]); i++)
-                {
-                    slide_controller_click(slc, event.button.x, event.button.y);
-                }
-
-                if (osc_type.value == OSC_TYPE_FM)
-                    fm_click(event.button.x, event.button.y);
-                else
-                    osc_click(event.button.x, event.button.y);
+                fprintf(stderr, "At most %d modulation routes\n", MOD_MAX_ROUTES);
+                usage(argv[0]);
+                return 1;
             }
-            else if (event.type == SDL_EVENT_MOUSE_BUTTON_UP)
+            mod_routes[nbr_mod_routes++] = optarg;
+            break;
+        case 'T':
+            if (parts_count() == PARTS_MAX || add_part(optarg, &part_settings[parts_count()]))
             {
-                int i;
-                struct square_controller *sqc;
-                struct slide_controller *slc;
-                for (i = 0; (sqc = sqc_arr[i]); i++)
-                {
-                    square_controller_unclick(sqc);
-                }
-                for (i = 0; (slc = slc_arr[i]); i++)
-                {
-                    slide_controller_unclick(slc);
-                }
-
-                if (osc_type.value == OSC_TYPE_FM)
-                    fm_unclick();
-                else
-                    osc_unclick();
+                usage(argv[0]);
+                return 1;
             }
-            else if (event.type == SDL_EVENT_MOUSE_MOTION)
+            break;
+        case 'a':
+            if (!strcmp(optarg, "sdl"))
             {
-                int i;
-                struct square_controller *sqc;
-                struct slide_controller *slc;
-                for (i = 0; (sqc = sqc_arr[i]); i++)
-                {
-                    square_controller_move(sqc, event.motion.x, event.motion.y);
-                }
-                for (i = 0; (slc = slc_arr[i]); i++)
-                {
-                    slide_controller_move(slc, event.motion.x, event.motion.y);
-                }
-                if (osc_type.value == OSC_TYPE_FM)
-                    fm_move(event.motion.x, event.motion.y);
-                else
-                    osc_move(event.motion.x, event.motion.y);
+                backend = AUDIO_SDL;
+            }
+            else if (!strncmp(optarg, "alsa", 4) && (!optarg[4] || optarg[4] == ':'))
+            {
+                backend = AUDIO_ALSA;
+                if (optarg[4])
+                    alsa_config.device = optarg + 5;
+            }
+#ifdef SYNTH_ONE_JACK
+            else if (!strcmp(optarg, "jack"))
+                backend = AUDIO_JACK;
+#endif
+            else
+            {
+                usage(argv[0]);
+                return 1;
             }
+            break;
+        case 'b':
+            if (parse_period(optarg, &alsa_config))
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ((replay_file && !offline_file) || (preset_name && !bank_file))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    // One part that plays everything unless told otherwise.
+    if (!parts_count())
+        parts_add(PART_OMNI, 0, 127);
+
+    // Offline rendering needs neither a window nor an audio device, so it also runs headless. With another backend
+    // SDL is only the window.
+    if (!offline_file)
+        sdl_flags |= backend == AUDIO_SDL ? SDL_INIT_AUDIO | SDL_INIT_VIDEO : SDL_INIT_VIDEO;
+    if (!SDL_Init(sdl_flags))
+    {
+        pr_sdl_err();
+        return -2;
+    }
+
+    signal(SIGINT, sig_handler);
+
+    // VIDEO STUFF
+    if (!offline_file)
+    {
+        window = SDL_CreateWindow("Synth One",      // window title
+                                  WIDTH,            // width, in pixels
+                                  HEIGHT,           // height, in pixels
+                                  SDL_WINDOW_OPENGL // flags - see below
+        );
+        if (!window)
+        {
+            pr_sdl_err();
+            return -1;
+        }
+
+        renderer = SDL_CreateRenderer(window, NULL);
+        if (!renderer)
+        {
+            pr_sdl_err();
+            return 1;
+        }
+
+        text_init(renderer);
+        if (ui_init(renderer, WIDTH, HEIGHT))
+            return 1;
+    }
+
+    engine = parts_engine(0);
+    engine->tap = journal_tap;
+    param_register_groups(engine->p.groups, PARAM_OWNER_MAIN);
+    param_register_groups(engine->fm.groups, PARAM_OWNER_FM);
+    param_register_groups(engine->osc.groups, PARAM_OWNER_OSC);
+    // Offline there is no window and no font to build the widgets with.
+    if (!offline_file)
+        add_widgets();
+
+    // AUDIO DEVICE
+    if (offline_file)
+    {
+        sample_frames = 2 * OFFLINE_BUFFER_FRAMES;
+        // A replay renders in the format it was recorded in.
+        if (replay_file && journal_replay_load(replay_file, &render_spec.freq, &render_spec.channels))
+            return 11;
+    }
+    else
+    {
+        if ((redraw_fd = setup_redraw_timer()) < 0)
+            return 1;
+        if (backend == AUDIO_SDL && !(devId = open_audio_device()))
+            return 2;
+        if (backend == AUDIO_JACK && open_jack())
+            return 2;
+        if (backend == AUDIO_ALSA && open_alsa(&alsa_config))
+            return 2;
+    }
+    buffer_frames = sample_frames / 2;
+    frame_size = calc_frame_size(&render_spec);
+    printf("Frame size %ld\n", frame_size);
+    buf = malloc(buffer_frames * frame_size);
+
+    // initialization of sub modules
+    diag_start();
+    if (parts_open(render_spec.freq, render_spec.channels, buffer_frames))
+        return 3;
+    sequencer_set_external(&engine->seq, follow_clock);
+    if (midi_config.out_cb && !follow_clock)
+        sequencer_set_clock_out(&engine->seq, &clock_out_events);
+
+    if (smf_file && smf_load(smf_file, render_spec.freq))
+        return 9;
+
+    // AUDIO STUFF
+
+    init_key_to_freq();
+
+    // SETTINGS, once every module has registered its parameters
+    if (optind < argc)
+        load_settings(argv[optind]);
+    else
+        load_settings(part_settings[0] ? part_settings[0] : DEFAULT_SETTINGS_FILE_NAME);
+    for (int i = 1; i < parts_count(); i++)
+    {
+        if (part_settings[i] && parts_load_settings(i, part_settings[i]) < 0)
+            printf("Failed to open \"%s\"\n", part_settings[i]);
+    }
+
+    for (int i = 0; i < nbr_mod_routes; i++)
+    {
+        if (mod_parse_route(&engine->mod, mod_routes[i]))
+            return 14;
+    }
+
+    if (bank_file && bank_load(bank_file))
+        return 13;
+    if (preset_name)
+    {
+        int program = bank_find(preset_name);
+        if (program < 0)
+        {
+            fprintf(stderr, "No preset \"%s\" in \"%s\"\n", preset_name, bank_file);
+            return 13;
         }
+        bank_select(program);
+    }
+
+    if (journal_file && journal_start(journal_file, render_spec.freq, render_spec.channels))
+        return 12;
+
+    // The part workers run like the audio thread.
+    if (rt_config.enabled)
+        realtime_lock_memory();
+    if (realtime_thread_attr_init(&audio_thread_attr, &rt_config))
+        printf("Real-time audio thread, priority %d\n", rt_config.priority);
+    if (parts_start(&audio_thread_attr))
+        return 15;
+
+    if (offline_file)
+    {
+        long long frames = replay_file ? journal_replay_length()
+                                       : smf_length() + OFFLINE_TAIL_SECONDS * render_spec.freq;
+        res = render_offline(offline_file, frames);
+        journal_stop(current_frame);
+        parts_stop();
+        parts_close();
+        diag_stop();
+        return res ? 10 : 0;
+    }
 
-        struct midi_message msg;
-        while (midi_get(midi_in, &msg))
+    if (backend == AUDIO_SDL && (status = start_sdl_audio(devId, &audio_timer, &audio_thread_attr)))
+        return status;
+    if (backend == AUDIO_JACK && start_jack())
+        return 16;
+    if (backend == AUDIO_ALSA && start_alsa(&alsa_config, &audio_thread_attr))
+        return 17;
+
+    // MIDI STUFF
+    if (smf_file)
+        smf_start();
+    midi_clock_init(&clock_in);
+    midi_start(&midi_config);
+
+    if (pthread_create(&redraw_tid, NULL, redraw_thread, NULL))
+    {
+        perror("Failed to create redraw thread!");
+        return 8;
+    }
+
+    SDL_Event event;
+    while (!synth_abort && SDL_WaitEvent(&event))
+    {
+        if (event.type == SDL_EVENT_KEY_DOWN)
         {
-            if (msg.type == MIDI_MSG_NOTE_ON)
+            int new_key;
+            switch (event.key.scancode)
             {
-                key_press(msg.note.key);
+            case SDL_SCANCODE_SPACE:
+                queue_key(SYNTH_EVENT_SEQ_RUN, 0, 0.0);
+                notes_off();
+                break;
+            case SDL_SCANCODE_ESCAPE:
+                sequencer_toggle_edit(&engine->seq);
+                break;
+            default:
+                new_key = pianokey_per_scancode[event.key.scancode];
+                if (new_key != 0)
+                {
+                    new_key += 12 * engine->p.octave.value;
+                    key_press(new_key);
+                }
+                if (engine->seq.edit)
+                    queue_key(SYNTH_EVENT_SEQ_INPUT, new_key, engine->p.gate.value);
             }
-            else if (msg.type == MIDI_MSG_NOTE_OFF)
+        }
+        else if (event.type == SDL_EVENT_KEY_UP)
+        {
+            int new_key = pianokey_per_scancode[event.key.scancode];
+            if (new_key != 0)
             {
-                key_release(msg.note.key);
+                new_key += 12 * engine->p.octave.value;
+                key_release(new_key);
             }
         }
-        usleep(750);
+        else if (event.type == SDL_EVENT_USER && event.user.code == USER_EVENT_REDRAW)
+        {
+            atomic_store(&redraw_pending, false);
+            draw_waveform(renderer);
+        }
+        else if (event.type == SDL_EVENT_MOUSE_BUTTON_DOWN)
+        {
+            ui_click(event.button.x, event.button.y);
+        }
+        else if (event.type == SDL_EVENT_MOUSE_BUTTON_UP)
+        {
+            ui_unclick();
+        }
+        else if (event.type == SDL_EVENT_MOUSE_MOTION)
+        {
+            ui_move(event.motion.x, event.motion.y);
+        }
+        else if (event.type == SDL_EVENT_RENDER_TARGETS_RESET || event.type == SDL_EVENT_RENDER_DEVICE_RESET)
+        {
+            // The retained ui layer lost its contents.
+            ui_invalidate();
+        }
+        else if (event.type == SDL_EVENT_QUIT)
+        {
+            synth_abort = true;
+        }
     }
+    synth_abort = true;
+    pthread_join(redraw_tid, NULL);
 
     save_settings();
 
-    midi_stop(midi_in);
+    midi_stop();
 
-    timer_delete(video_timer);
-    timer_delete(audio_timer);
+    close(redraw_fd);
+    if (backend == AUDIO_SDL)
+        timer_delete(audio_timer);
+    else if (backend == AUDIO_JACK)
+        stop_jack();
+    else
+        alsa_pcm_stop();
+    journal_stop(current_frame);
+    bank_free();
+    pthread_mutex_lock(&mutex);
+    parts_stop();
+    parts_close();
+    pthread_mutex_unlock(&mutex);
+    diag_stop();
 
-    SDL_DestroyAudioStream(stream);
-    SDL_CloseAudioDevice(devId);
+    if (backend == AUDIO_SDL)
+    {
+        SDL_DestroyAudioStream(stream);
+        SDL_CloseAudioDevice(devId);
+    }
 
     return 0;
 }
@@ -1,13 +1,28 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "text.h"
 
+#define MAX_BATCH_GLYPHS (2048)
+
 static SDL_Surface *text_surface;
 static SDL_Texture *text_texture;
 
 static const int text_height = 16;
 static const int text_width = 8;
 
+// All text of a frame is collected here and drawn with a single SDL_RenderGeometry call in text_flush().
+static SDL_Vertex batch_vertices[MAX_BATCH_GLYPHS * 4];
+static int batch_indices[MAX_BATCH_GLYPHS * 6];
+static int batch_glyphs = 0;
+
+struct text_label
+{
+    int nbr_glyphs;
+    SDL_Vertex vertices[];
+};
+
 int text_get_height()
 {
 
@@ -32,6 +47,18 @@ void text_init(SDL_Renderer *renderer)
     {
         printf("Failed to create texture\n");
     }
+
+    // The quads never change winding, so the index buffer is the same for every frame.
+    for (int i = 0; i < MAX_BATCH_GLYPHS; i++)
+    {
+        int *idx = &batch_indices[i * 6];
+        idx[0] = i * 4;
+        idx[1] = i * 4 + 1;
+        idx[2] = i * 4 + 2;
+        idx[3] = i * 4;
+        idx[4] = i * 4 + 2;
+        idx[5] = i * 4 + 3;
+    }
 }
 
 void text_exit()
@@ -40,36 +67,91 @@ void text_exit()
     SDL_DestroySurface(text_surface);
 }
 
-void text_draw(SDL_Renderer *renderer, const char *text, int x, int y, bool vertical)
+// Writes one quad per character to v. Vertical text is rotated 90 degrees counter clockwise around the start
+// position and runs upwards.
+static int build_glyphs(SDL_Vertex *v, const char *text, int x, int y, bool vertical)
 {
     int i;
     char c;
-    SDL_FRect dstrect = {.x = x, .y = y, .w = text_width, .h = text_height};
-    SDL_FRect srcrect = {.x = x, .y = y, .w = text_width, .h = text_height};
+    const SDL_FColor white = {1.0, 1.0, 1.0, 1.0};
 
-    if (vertical)
+    for (i = 0; (c = text[i]); i++, v += 4)
     {
-    dstrect.w = text_width;
-    dstrect.h = text_height;
-        for (i = 0; (c = text[i]); i++)
+        // Source image is a representation of ascii chars from 32 and up, 32 per "line".
+        float u0 = 1.0 * text_width * (c % 32) / text_surface->w;
+        float v0 = 1.0 * text_height * (c / 32 - 1) / text_surface->h;
+        float u1 = u0 + 1.0 * text_width / text_surface->w;
+        float v1 = v0 + 1.0 * text_height / text_surface->h;
+
+        if (vertical)
         {
-            // Source image is a representation of ascii chars from 32 and up, 32 per "line".
-            srcrect.x = text_width * (c % 32);
-            srcrect.y = text_height * (c / 32 - 1);
-            if (!SDL_RenderTextureRotated(renderer, text_texture, &srcrect, &dstrect, -90,&(SDL_FPoint){}, SDL_FLIP_NONE))
-                printf("Failed to render text!\n");
-            dstrect.y -= text_width;
+            float gy = y - i * text_width;
+            v[0].position = (SDL_FPoint){x, gy};
+            v[1].position = (SDL_FPoint){x, gy - text_width};
+            v[2].position = (SDL_FPoint){x + text_height, gy - text_width};
+            v[3].position = (SDL_FPoint){x + text_height, gy};
         }
-    }
-    else
-    {
-        for (i = 0; (c = text[i]); i++)
+        else
         {
-            srcrect.x = text_width * (c % 32);
-            srcrect.y = text_height * (c / 32 - 1);
-            if (!SDL_RenderTexture(renderer, text_texture, &srcrect, &dstrect))
-                printf("Failed to render text!\n");
-            dstrect.x += text_width;
+            float gx = x + i * text_width;
+            v[0].position = (SDL_FPoint){gx, y};
+            v[1].position = (SDL_FPoint){gx + text_width, y};
+            v[2].position = (SDL_FPoint){gx + text_width, y + text_height};
+            v[3].position = (SDL_FPoint){gx, y + text_height};
         }
+        v[0].tex_coord = (SDL_FPoint){u0, v0};
+        v[1].tex_coord = (SDL_FPoint){u1, v0};
+        v[2].tex_coord = (SDL_FPoint){u1, v1};
+        v[3].tex_coord = (SDL_FPoint){u0, v1};
+        v[0].color = v[1].color = v[2].color = v[3].color = white;
     }
+    return i;
+}
+
+void text_flush(SDL_Renderer *renderer)
+{
+    if (batch_glyphs == 0)
+        return;
+    if (!SDL_RenderGeometry(renderer, text_texture, batch_vertices, batch_glyphs * 4, batch_indices,
+                            batch_glyphs * 6))
+        printf("Failed to render text!\n");
+    batch_glyphs = 0;
+}
+
+void text_draw(SDL_Renderer *renderer, const char *text, int x, int y, bool vertical)
+{
+    int len = strlen(text);
+    if (len > MAX_BATCH_GLYPHS)
+        return;
+    if (batch_glyphs + len > MAX_BATCH_GLYPHS)
+        text_flush(renderer);
+    batch_glyphs += build_glyphs(&batch_vertices[batch_glyphs * 4], text, x, y, vertical);
+}
+
+struct text_label *text_label_create(const char *text, int x, int y, bool vertical)
+{
+    int len = strlen(text);
+    struct text_label *label = malloc(sizeof(*label) + len * 4 * sizeof(SDL_Vertex));
+    if (!label)
+    {
+        printf("Failed to allocate text label\n");
+        return NULL;
+    }
+    label->nbr_glyphs = build_glyphs(label->vertices, text, x, y, vertical);
+    return label;
+}
+
+void text_label_draw(SDL_Renderer *renderer, struct text_label *label)
+{
+    if (!label || label->nbr_glyphs > MAX_BATCH_GLYPHS)
+        return;
+    if (batch_glyphs + label->nbr_glyphs > MAX_BATCH_GLYPHS)
+        text_flush(renderer);
+    memcpy(&batch_vertices[batch_glyphs * 4], label->vertices, label->nbr_glyphs * 4 * sizeof(SDL_Vertex));
+    batch_glyphs += label->nbr_glyphs;
+}
+
+void text_label_destroy(struct text_label *label)
+{
+    free(label);
 }
@@ -2,8 +2,17 @@
 
 #include <SDL3/SDL_render.h>
 
+// Text is queued and drawn in one batch by text_flush(), which must be called before presenting.
+struct text_label;
+
 void text_init(SDL_Renderer *renderer);
 void text_exit();
 void text_draw(SDL_Renderer *renderer, const char *text, int x, int y, bool vertical);
+void text_flush(SDL_Renderer *renderer);
 int text_get_height();
 int text_get_width();
+
+// Labels that never change have their glyphs built once.
+struct text_label *text_label_create(const char *text, int x, int y, bool vertical);
+void text_label_draw(SDL_Renderer *renderer, struct text_label *label);
+void text_label_destroy(struct text_label *label);
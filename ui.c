@@ -0,0 +1,359 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "text.h"
+#include "ui.h"
+#include "util.h"
+
+#define MAX_WIDGETS (256)
+#define CELL_SIZE (32)
+#define MAX_GRID_W (64)
+#define MAX_GRID_H (48)
+#define MAX_PER_CELL (16)
+#define MARKER_MARGIN (2)
+
+enum widget_type
+{
+    WIDGET_SLIDER,
+    WIDGET_SQUARE,
+    WIDGET_CUSTOM,
+};
+
+struct widget
+{
+    enum widget_type type;
+    enum ui_panel panel;
+    SDL_FRect area; // everything the widget draws, cleared before a redraw
+    SDL_FRect hit;  // where it takes clicks, empty for custom widgets
+    union {
+        struct slide_controller *slider;
+        struct square_controller *square;
+        struct
+        {
+            void (*draw)(SDL_Renderer *renderer);
+            unsigned (*state)();
+        } custom;
+    };
+    float seen_value[2];
+    unsigned seen_state;
+    bool dirty;
+};
+
+static struct widget widgets[MAX_WIDGETS];
+static int nbr_widgets = 0;
+
+static unsigned char cells[MAX_GRID_H][MAX_GRID_W][MAX_PER_CELL];
+static unsigned char cell_count[MAX_GRID_H][MAX_GRID_W];
+static int grid_w;
+static int grid_h;
+
+static bool panel_visible[UI_PANEL_COUNT] = {[UI_PANEL_MAIN] = true};
+static bool full_redraw = true;
+static struct widget *grabbed = NULL;
+
+static SDL_Texture *layer;
+
+int ui_init(SDL_Renderer *renderer, int width, int height)
+{
+    grid_w = min(MAX_GRID_W, (width + CELL_SIZE - 1) / CELL_SIZE);
+    grid_h = min(MAX_GRID_H, (height + CELL_SIZE - 1) / CELL_SIZE);
+
+    layer = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, width, height);
+    if (!layer)
+    {
+        fprintf(stderr, "%s: Failed to create ui layer: %s\n", __func__, SDL_GetError());
+        return -1;
+    }
+    return 0;
+}
+
+void ui_exit()
+{
+    SDL_DestroyTexture(layer);
+}
+
+static SDL_FRect rect_union(SDL_FRect a, SDL_FRect b)
+{
+    float x0 = min(a.x, b.x);
+    float y0 = min(a.y, b.y);
+    float x1 = max(a.x + a.w, b.x + b.w);
+    float y1 = max(a.y + a.h, b.y + b.h);
+    return (SDL_FRect){x0, y0, x1 - x0, y1 - y0};
+}
+
+static bool rect_overlap(const SDL_FRect *a, const SDL_FRect *b)
+{
+    return a->x < b->x + b->w && b->x < a->x + a->w && a->y < b->y + b->h && b->y < a->y + a->h;
+}
+
+static bool rect_contains(const SDL_FRect *r, int x, int y)
+{
+    return x >= r->x && x <= r->x + r->w && y >= r->y && y <= r->y + r->h;
+}
+
+// Same extent as text_draw() gives the label.
+static SDL_FRect label_rect(const char *label, int x, int y, bool vertical)
+{
+    float len = strlen(label) * text_get_width();
+    if (vertical)
+        return (SDL_FRect){x, y - len, text_get_height(), len};
+    return (SDL_FRect){x, y, len, text_get_height()};
+}
+
+static void cell_range(const SDL_FRect *r, int *cx0, int *cy0, int *cx1, int *cy1)
+{
+    *cx0 = max(0, (int)r->x / CELL_SIZE);
+    *cy0 = max(0, (int)r->y / CELL_SIZE);
+    *cx1 = min(grid_w - 1, (int)(r->x + r->w) / CELL_SIZE);
+    *cy1 = min(grid_h - 1, (int)(r->y + r->h) / CELL_SIZE);
+}
+
+// Widgets are indexed by the area they draw in, that covers both redraw overlap and hit testing.
+static struct widget *add_widget(enum widget_type type, enum ui_panel panel, SDL_FRect area, SDL_FRect hit)
+{
+    int cx0, cy0, cx1, cy1;
+    struct widget *w;
+
+    if (nbr_widgets == MAX_WIDGETS)
+    {
+        fprintf(stderr, "%s: Too many widgets\n", __func__);
+        return NULL;
+    }
+    w = &widgets[nbr_widgets];
+    *w = (struct widget){.type = type, .panel = panel, .area = area, .hit = hit, .dirty = true};
+
+    cell_range(&area, &cx0, &cy0, &cx1, &cy1);
+    for (int cy = cy0; cy <= cy1; cy++)
+    {
+        for (int cx = cx0; cx <= cx1; cx++)
+        {
+            if (cell_count[cy][cx] == MAX_PER_CELL)
+            {
+                fprintf(stderr, "%s: Grid cell %d,%d is full\n", __func__, cx, cy);
+                continue;
+            }
+            cells[cy][cx][cell_count[cy][cx]++] = nbr_widgets;
+        }
+    }
+    nbr_widgets++;
+    return w;
+}
+
+void ui_add_slider(struct slide_controller *sc, enum ui_panel panel)
+{
+    SDL_FRect hit = {sc->x, sc->y, sc->width, sc->height};
+    SDL_FRect area = {sc->x - MARKER_MARGIN, sc->y - MARKER_MARGIN, sc->width + 2 * MARKER_MARGIN,
+                      sc->height + 2 * MARKER_MARGIN};
+    bool vertical = sc->width <= sc->height;
+
+    area = rect_union(area, label_rect(sc->label, vertical ? sc->x + sc->width : sc->x, sc->y + sc->height,
+                                       vertical));
+    struct widget *w = add_widget(WIDGET_SLIDER, panel, area, hit);
+    if (w)
+        w->slider = sc;
+}
+
+void ui_add_square(struct square_controller *sc, enum ui_panel panel)
+{
+    SDL_FRect hit = {sc->x, sc->y, sc->width, sc->height};
+    SDL_FRect area = {sc->x - MARKER_MARGIN, sc->y - MARKER_MARGIN, sc->width + 2 * MARKER_MARGIN,
+                      sc->height + 2 * MARKER_MARGIN};
+
+    area = rect_union(area, label_rect(sc->x_label, sc->x, sc->y + sc->height, false));
+    area = rect_union(area, label_rect(sc->y_label, sc->x + sc->width, sc->y + sc->height, true));
+    struct widget *w = add_widget(WIDGET_SQUARE, panel, area, hit);
+    if (w)
+        w->square = sc;
+}
+
+void ui_add_custom(SDL_FRect area, enum ui_panel panel, void (*draw)(SDL_Renderer *renderer), unsigned (*state)())
+{
+    struct widget *w = add_widget(WIDGET_CUSTOM, panel, area, (SDL_FRect){});
+    if (w)
+    {
+        w->custom.draw = draw;
+        w->custom.state = state;
+    }
+}
+
+void ui_show_panel(enum ui_panel panel, bool visible)
+{
+    if (panel_visible[panel] != visible)
+    {
+        panel_visible[panel] = visible;
+        full_redraw = true;
+        if (grabbed && grabbed->panel == panel)
+            ui_unclick();
+    }
+}
+
+void ui_invalidate()
+{
+    full_redraw = true;
+}
+
+void ui_click(int x, int y)
+{
+    int cx = x / CELL_SIZE;
+    int cy = y / CELL_SIZE;
+
+    if (x < 0 || y < 0 || cx >= grid_w || cy >= grid_h)
+        return;
+
+    for (int i = 0; i < cell_count[cy][cx]; i++)
+    {
+        struct widget *w = &widgets[cells[cy][cx][i]];
+        if (!panel_visible[w->panel] || !rect_contains(&w->hit, x, y))
+            continue;
+        if (w->type == WIDGET_SLIDER)
+            slide_controller_click(w->slider, x, y);
+        else if (w->type == WIDGET_SQUARE)
+            square_controller_click(w->square, x, y);
+        else
+            continue;
+        grabbed = w;
+        return;
+    }
+}
+
+void ui_unclick()
+{
+    if (!grabbed)
+        return;
+    if (grabbed->type == WIDGET_SLIDER)
+        slide_controller_unclick(grabbed->slider);
+    else if (grabbed->type == WIDGET_SQUARE)
+        square_controller_unclick(grabbed->square);
+    grabbed = NULL;
+}
+
+// Only a grabbed widget follows the mouse, so motion never needs a lookup.
+void ui_move(int x, int y)
+{
+    if (!grabbed)
+        return;
+    if (grabbed->type == WIDGET_SLIDER)
+        slide_controller_move(grabbed->slider, x, y);
+    else if (grabbed->type == WIDGET_SQUARE)
+        square_controller_move(grabbed->square, x, y);
+}
+
+// Picks up changes from any source, mouse, settings or the audio side, by comparing to what was drawn last.
+static bool widget_changed(struct widget *w)
+{
+    switch (w->type)
+    {
+    case WIDGET_SLIDER:
+        return *w->slider->control.target != w->seen_value[0];
+    case WIDGET_SQUARE:
+        return *w->square->x_control.target != w->seen_value[0] || *w->square->y_control.target != w->seen_value[1];
+    case WIDGET_CUSTOM:
+        return w->custom.state() != w->seen_state;
+    }
+    return false;
+}
+
+static void widget_draw(SDL_Renderer *renderer, struct widget *w)
+{
+    switch (w->type)
+    {
+    case WIDGET_SLIDER:
+        w->seen_value[0] = *w->slider->control.target;
+        slide_controller_set_pos_from_value(w->slider);
+        slide_controller_draw(renderer, w->slider);
+        break;
+    case WIDGET_SQUARE:
+        w->seen_value[0] = *w->square->x_control.target;
+        w->seen_value[1] = *w->square->y_control.target;
+        square_controller_draw(renderer, w->square);
+        break;
+    case WIDGET_CUSTOM:
+        w->seen_state = w->custom.state();
+        w->custom.draw(renderer);
+        break;
+    }
+    w->dirty = false;
+}
+
+// Clearing a dirty widget also wipes whatever its neighbours drew in the same area, so they have to be redrawn too.
+// Returns true if a neighbour was newly marked.
+static bool mark_overlapping(struct widget *w)
+{
+    bool marked = false;
+    int cx0, cy0, cx1, cy1;
+    cell_range(&w->area, &cx0, &cy0, &cx1, &cy1);
+    for (int cy = cy0; cy <= cy1; cy++)
+    {
+        for (int cx = cx0; cx <= cx1; cx++)
+        {
+            for (int i = 0; i < cell_count[cy][cx]; i++)
+            {
+                struct widget *other = &widgets[cells[cy][cx][i]];
+                if (!other->dirty && panel_visible[other->panel] && rect_overlap(&w->area, &other->area))
+                {
+                    other->dirty = true;
+                    marked = true;
+                }
+            }
+        }
+    }
+    return marked;
+}
+
+// Brings the ui layer up to date and copies it to the current render target.
+void ui_draw(SDL_Renderer *renderer)
+{
+    int i;
+    bool any_dirty = full_redraw;
+
+    for (i = 0; i < nbr_widgets; i++)
+    {
+        struct widget *w = &widgets[i];
+        if (!panel_visible[w->panel])
+            continue;
+        if (full_redraw || widget_changed(w))
+        {
+            w->dirty = true;
+            any_dirty = true;
+        }
+    }
+
+    if (any_dirty)
+    {
+        SDL_SetRenderTarget(renderer, layer);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+        if (full_redraw)
+        {
+            SDL_RenderClear(renderer);
+        }
+        else
+        {
+            bool marked = true;
+            while (marked)
+            {
+                marked = false;
+                for (i = 0; i < nbr_widgets; i++)
+                {
+                    if (widgets[i].dirty && panel_visible[widgets[i].panel])
+                        marked |= mark_overlapping(&widgets[i]);
+                }
+            }
+            for (i = 0; i < nbr_widgets; i++)
+            {
+                if (widgets[i].dirty && panel_visible[widgets[i].panel])
+                    SDL_RenderFillRect(renderer, &widgets[i].area);
+            }
+        }
+
+        for (i = 0; i < nbr_widgets; i++)
+        {
+            if (widgets[i].dirty && panel_visible[widgets[i].panel])
+                widget_draw(renderer, &widgets[i]);
+        }
+        text_flush(renderer);
+        SDL_SetRenderTarget(renderer, NULL);
+        full_redraw = false;
+    }
+
+    SDL_RenderTexture(renderer, layer, NULL, NULL);
+}
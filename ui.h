@@ -0,0 +1,34 @@
+#pragma once
+
+#include <SDL3/SDL_render.h>
+
+#include "slide_controller.h"
+#include "square_controller.h"
+
+// Retained widget layer. Widgets are drawn into an offscreen layer that is only touched where something changed,
+// and mouse events are routed through a grid so only the widgets under the pointer see them.
+
+enum ui_panel
+{
+    UI_PANEL_MAIN = 0,
+    UI_PANEL_OSC,
+    UI_PANEL_FM,
+    UI_PANEL_COUNT,
+};
+
+int ui_init(SDL_Renderer *renderer, int width, int height);
+void ui_exit();
+
+void ui_add_slider(struct slide_controller *sc, enum ui_panel panel);
+void ui_add_square(struct square_controller *sc, enum ui_panel panel);
+// A widget without mouse input. It is redrawn whenever state() returns something new.
+void ui_add_custom(SDL_FRect area, enum ui_panel panel, void (*draw)(SDL_Renderer *renderer), unsigned (*state)());
+
+void ui_show_panel(enum ui_panel panel, bool visible);
+void ui_invalidate();
+
+void ui_click(int x, int y);
+void ui_unclick();
+void ui_move(int x, int y);
+
+void ui_draw(SDL_Renderer *renderer);
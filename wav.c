@@ -0,0 +1,35 @@
+#include <stdint.h>
+
+#include "wav.h"
+
+static void put_u32(FILE *f, uint32_t v)
+{
+    unsigned char b[4] = {v, v >> 8, v >> 16, v >> 24};
+    fwrite(b, 1, 4, f);
+}
+
+static void put_u16(FILE *f, uint16_t v)
+{
+    unsigned char b[2] = {v, v >> 8};
+    fwrite(b, 1, 2, f);
+}
+
+// Header for 32 bit float samples, interleaved, which is what the renderer produces.
+int wav_write_header(FILE *f, int sample_rate, int channels, long long frames)
+{
+    uint32_t data_size = frames * channels * sizeof(float);
+
+    fwrite("RIFF", 1, 4, f);
+    put_u32(f, 36 + data_size);
+    fwrite("WAVEfmt ", 1, 8, f);
+    put_u32(f, 16);
+    put_u16(f, 3); // IEEE float
+    put_u16(f, channels);
+    put_u32(f, sample_rate);
+    put_u32(f, sample_rate * channels * sizeof(float));
+    put_u16(f, channels * sizeof(float));
+    put_u16(f, 32);
+    fwrite("data", 1, 4, f);
+    put_u32(f, data_size);
+    return ferror(f) ? -1 : 0;
+}
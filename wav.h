@@ -0,0 +1,5 @@
+#pragma once
+
+#include <stdio.h>
+
+int wav_write_header(FILE *f, int sample_rate, int channels, long long frames);